@@ -30,6 +30,7 @@
 #include <vector>
 #include "file_handler.h"
 #include "kd_math.h"
+#include "kd_point_set.h"
 
 using namespace std;
 
@@ -38,27 +39,48 @@ vector<Point<T>*> FileHandler<T>::csvReadInput(const string& file_name) {
     vector<Point<T>*> input_points;
     vector<T> single_point;
     ifstream input_file(file_name);
-    string line;
     int line_count = 0;
 
-    while (input_file.good() && !input_file.eof()) {
-       if (!getline(input_file, line))
-           continue;
-        stringstream lineStream(line);
-        string cell;
-
-        while(getline(lineStream, cell, ',')) {
-            single_point.push_back(T(stod(cell)));
-        }
+    while (csvReadNext(input_file, single_point)) {
         Point<T>* pt = new Point<T>(single_point, line_count);
         input_points.push_back(pt);
-        single_point.clear();
         ++line_count;
     }
     input_file.close();
     return input_points;
 }
 
+template <typename T>
+PointSet<T> FileHandler<T>::csvReadPointSet(const string& file_name) {
+    PointSet<T> input_points;
+    vector<T> single_point;
+    ifstream input_file(file_name);
+    size_t line_count = 0;
+
+    while (csvReadNext(input_file, single_point)) {
+        if (!single_point.empty())
+            input_points.push_back(single_point.data(), single_point.size(), line_count);
+        ++line_count;
+    }
+    input_file.close();
+    return input_points;
+}
+
+template <typename T>
+bool FileHandler<T>::csvReadNext(istream& input_file, vector<T>& coords) {
+    string line;
+    coords.clear();
+    if (!input_file.good() || !getline(input_file, line))
+        return false;
+
+    stringstream lineStream(line);
+    string cell;
+    while(getline(lineStream, cell, ',')) {
+        coords.push_back(T(stod(cell)));
+    }
+    return true;
+}
+
 template <typename T>
 void FileHandler<T>::csvWriteNnResults(const vector<size_t>& pointId,
                                       const vector<T>& dist,
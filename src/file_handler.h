@@ -24,7 +24,9 @@
 #define FILE_HANDLER_H_
 
 #include <vector>
+#include <istream>
 #include "kd_math.h"
+#include "kd_point_set.h"
 
 template <typename T=double>
 class FileHandler {
@@ -32,6 +34,14 @@ public:
     // Reads input file and stores data as a vector of Points
     static std::vector<Point<T>*> csvReadInput(const std::string& file_name="data/sample_data.csv");
 
+    // Reads input file into a single PointSet, with each Point's id set to
+    // its line number. Empty lines are skipped.
+    static PointSet<T> csvReadPointSet(const std::string& file_name="data/sample_data.csv");
+
+    // Reads the next line of an open input file into coords, for streaming
+    // files too large to hold in memory. Returns false at end of file.
+    static bool csvReadNext(std::istream& input_file, std::vector<T>& coords);
+
     // Writes Nearest-Neighbor search results to file
     // in the format: point_index,distance
     static void csvWriteNnResults(const std::vector<size_t>& pointId,
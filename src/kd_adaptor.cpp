@@ -0,0 +1,228 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_ADAPTOR_CPP_
+#define KD_ADAPTOR_CPP_
+
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_adaptor.h"
+
+using namespace std;
+
+namespace {
+
+// Points read per subset to find the axis of widest range
+const size_t range_sample_size = 256;
+
+}
+
+template <typename T>
+BufferAdaptor<T>::BufferAdaptor(const T* data, const size_t& count, const size_t& dimension,
+                                const Order_t& order, const size_t& stride) :
+                                data_(data), count_(count), dimension_(dimension) {
+    if (order == Order_t::ROW_MAJOR) {
+        point_step_ = (stride == 0) ? dimension : stride;
+        axis_step_ = 1;
+    }
+    else {
+        point_step_ = 1;
+        axis_step_ = (stride == 0) ? count : stride;
+    }
+}
+
+template <typename T>
+BufferAdaptor<T>::BufferAdaptor(const PointSet<T>& points) :
+                                BufferAdaptor(points.data(), points.size(), points.getDimension()) {}
+
+template <typename T>
+size_t BufferAdaptor<T>::size() const {
+    return count_;
+}
+
+template <typename T>
+size_t BufferAdaptor<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+T BufferAdaptor<T>::getCoordinate(const size_t& point, const size_t& axis) const {
+    return data_[point*point_step_ + axis*axis_step_];
+}
+
+template <typename T, typename Dataset>
+uint32_t AdaptorKdTree<T, Dataset>::buildTree(vector<uint32_t>& order, const size_t& begin,
+                                              const size_t& end, const size_t& depth) {
+    if (begin == end)
+        return FlatKdTree<T>::null_node_;
+
+    const Dataset& dataset = dataset_;
+    size_t dimension = dataset.getDimension();
+    size_t count = end - begin;
+    size_t split_axis = depth % dimension;
+    if (KdTree<T>::split_method_ != KdTree<T>::SplitMethod_t::CYCLE && count > 1) {
+        // Widest range over an evenly spaced sample of the subset
+        size_t stride = max(count/range_sample_size, size_t(1));
+        vector<T> low(dimension, numeric_limits<T>::max());
+        vector<T> high(dimension, numeric_limits<T>::lowest());
+        for (size_t i = begin; i < end; i += stride) {
+            for (size_t axis = 0; axis < dimension; ++axis) {
+                T coord = dataset.getCoordinate(order[i], axis);
+                low[axis] = min(low[axis], coord);
+                high[axis] = max(high[axis], coord);
+            }
+        }
+        split_axis = 0;
+        for (size_t axis = 1; axis < dimension; ++axis) {
+            if (high[axis] - low[axis] > high[split_axis] - low[split_axis])
+                split_axis = axis;
+        }
+    }
+
+    // Median Point is the node's pivot. Points left of it are <= the split
+    // position and Points right of it are >=.
+    size_t middle = begin + count/2;
+    nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                [&dataset, &split_axis](const uint32_t& a, const uint32_t& b) {
+                    return dataset.getCoordinate(a, split_axis) < dataset.getCoordinate(b, split_axis);
+                });
+
+    uint32_t id = nodes_.size();
+    FlatKdNode<T> node;
+    node.point = order[middle];
+    node.split_axis = split_axis;
+    node.split_position = dataset.getCoordinate(order[middle], split_axis);
+    nodes_.push_back(node);
+    uint32_t left_child = buildTree(order, begin, middle, depth+1);
+    uint32_t right_child = buildTree(order, middle+1, end, depth+1);
+    nodes_[id].left_child = left_child;
+    nodes_[id].right_child = right_child;
+    return id;
+}
+
+template <typename T, typename Dataset>
+AdaptorKdTree<T, Dataset> AdaptorKdTree<T, Dataset>::build(const Dataset& dataset) {
+    AdaptorKdTree<T, Dataset> tree;
+    tree.dataset_ = dataset;
+    if (dataset.size() >= size_t(FlatKdTree<T>::null_node_))
+        throw runtime_error("Too many points for 32-bit node offsets");
+    if (dataset.size() == 0 || dataset.getDimension() == 0)
+        return tree;
+
+    // Only the positions are permuted; the dataset is never written
+    vector<uint32_t> order(dataset.size());
+    iota(order.begin(), order.end(), uint32_t(0));
+    tree.nodes_.reserve(dataset.size());
+    tree.buildTree(order, 0, order.size(), 0);
+    return tree;
+}
+
+template <typename T, typename Dataset>
+bool AdaptorKdTree<T, Dataset>::isEmpty() const {
+    return nodes_.empty();
+}
+
+template <typename T, typename Dataset>
+size_t AdaptorKdTree<T, Dataset>::getDimension() const {
+    return dataset_.getDimension();
+}
+
+template <typename T, typename Dataset>
+size_t AdaptorKdTree<T, Dataset>::getMemoryUsage() const {
+    return nodes_.size()*sizeof(FlatKdNode<T>);
+}
+
+template <typename T, typename Dataset>
+void AdaptorKdTree<T, Dataset>::getNearestNeighbor(const uint32_t& node, const T* query,
+                                                   uint32_t& best_point, T& best_dist) const {
+    const FlatKdNode<T>& flat_node = nodes_[node];
+    size_t dimension = dataset_.getDimension();
+    T distance = T(0);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        T diff = dataset_.getCoordinate(flat_node.point, axis) - query[axis];
+        distance += diff*diff;
+    }
+    if (distance < best_dist) {
+        best_dist = distance;
+        best_point = flat_node.point;
+    }
+    if (flat_node.isLeaf())
+        return;
+
+    T plane_dist = query[flat_node.split_axis] - flat_node.split_position;
+    uint32_t near_child = (plane_dist < T(0)) ? flat_node.left_child : flat_node.right_child;
+    uint32_t far_child = (plane_dist < T(0)) ? flat_node.right_child : flat_node.left_child;
+    if (near_child != FlatKdTree<T>::null_node_)
+        getNearestNeighbor(near_child, query, best_point, best_dist);
+    if (far_child != FlatKdTree<T>::null_node_ && plane_dist*plane_dist < best_dist)
+        getNearestNeighbor(far_child, query, best_point, best_dist);
+}
+
+template <typename T, typename Dataset>
+pair<size_t, T> AdaptorKdTree<T, Dataset>::findNearest(const T* query) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    uint32_t best_point = 0;
+    T best_dist = numeric_limits<T>::max();
+    getNearestNeighbor(0, query, best_point, best_dist);
+    return make_pair(size_t(best_point), sqrt(best_dist));
+}
+
+template <typename T, typename Dataset>
+pair<size_t, T> AdaptorKdTree<T, Dataset>::findNearest(const Point<T>& query) const {
+    return findNearest(query.begin());
+}
+
+template <typename T, typename Dataset>
+void AdaptorKdTree<T, Dataset>::queryAdaptorKdTree(const AdaptorKdTree<T, Dataset>& tree,
+                                                   const PointSet<T>& query_points) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = tree.findNearest(query_points[i].begin());
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class BufferAdaptor<float>;
+template class BufferAdaptor<double>;
+template class AdaptorKdTree<float>;
+template class AdaptorKdTree<double>;
+
+
+#endif /* KD_ADAPTOR_CPP_ */
@@ -0,0 +1,113 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_ADAPTOR_H_
+#define KD_ADAPTOR_H_
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_point_set.h"
+
+// Dataset adaptor reading a caller-owned coordinate buffer in place.
+// ROW_MAJOR finds axis a of Point i at data[i*stride + a] (stride defaults
+// to the dimension); COLUMN_MAJOR finds it at data[a*stride + i] (stride
+// defaults to the count). Any class with the same size(), getDimension()
+// and getCoordinate() members can be the Dataset of an AdaptorKdTree.
+template <typename T=double>
+class BufferAdaptor {
+public:
+    enum class Order_t {ROW_MAJOR, COLUMN_MAJOR};
+
+private:
+    const T* data_ = nullptr;
+    size_t count_ = 0;
+    size_t dimension_ = 0;
+    size_t point_step_ = 0;     // Distance between the same axis of consecutive Points
+    size_t axis_step_ = 0;      // Distance between consecutive axes of a Point
+
+public:
+    BufferAdaptor() = default;      // Empty view
+    BufferAdaptor(const T* data, const size_t& count, const size_t& dimension,
+                  const Order_t& order = Order_t::ROW_MAJOR, const size_t& stride = 0);
+
+    // Row-major view of the buffer of a PointSet, by position in the set
+    explicit BufferAdaptor(const PointSet<T>& points);
+
+    size_t size() const;
+    size_t getDimension() const;
+    T getCoordinate(const size_t& point, const size_t& axis) const;
+};
+
+// Static KD-tree over a dataset adaptor, kept by value. Nodes refer to
+// Points by their position in the dataset, so the tree itself holds one
+// FlatKdNode per Point besides the adaptor. An adaptor such as
+// BufferAdaptor copies only its view, and the buffer it reads must outlive
+// the tree unchanged.
+// Searches are Euclidean; the other metrics need transformed copies.
+template <typename T=double, typename Dataset=BufferAdaptor<T>>
+class AdaptorKdTree {
+private:
+    Dataset dataset_;
+    std::vector<FlatKdNode<T>> nodes_;      // Preorder, root first
+
+    // Build the subtree of the Points at positions order[begin, end)
+    uint32_t buildTree(std::vector<uint32_t>& order, const size_t& begin,
+                       const size_t& end, const size_t& depth);
+
+    // Recursively find nearest neighbor. Distances are squared.
+    void getNearestNeighbor(const uint32_t& node, const T* query,
+                            uint32_t& best_point, T& best_dist) const;
+
+public:
+    // Constructors/Destructor
+    AdaptorKdTree() = default;
+    ~AdaptorKdTree() = default;
+
+    // Build over a copy of the dataset adaptor. Split axes follow
+    // KdTree<T>::split_method_: CYCLE cycles through the axes and the other
+    // methods take the axis of widest range in a sample of each subset.
+    static AdaptorKdTree<T, Dataset> build(const Dataset& dataset);
+
+    // Member functions
+    bool isEmpty() const;
+    size_t getDimension() const;
+    size_t getMemoryUsage() const;      // Bytes held by the tree, not the dataset
+
+    // Nearest Point to a query of getDimension() coordinates.
+    // Returns {position in the dataset, Euclidean distance}.
+    std::pair<size_t, T> findNearest(const T* query) const;
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Query the tree for a set of points, writing dataset positions
+    static void queryAdaptorKdTree(const AdaptorKdTree<T, Dataset>& tree,
+                                   const PointSet<T>& query_points);
+};
+
+
+#include "kd_adaptor.cpp"
+
+#endif // KD_ADAPTOR_H_ //
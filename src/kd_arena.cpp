@@ -0,0 +1,132 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_ARENA_CPP_
+#define KD_ARENA_CPP_
+
+#include <vector>
+#include <new>
+#include <algorithm>
+#include <stdint.h>
+#include "kd_arena.h"
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Size of the transparent huge pages blocks are rounded up to
+const size_t huge_page_bytes = size_t(2) << 20;
+
+// First offset at or after offset whose address in data is a multiple of
+// alignment
+inline size_t getAlignedOffset(const char* data, const size_t& offset, const size_t& alignment) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(data) + offset;
+    return offset + (((address + alignment - 1) & ~uintptr_t(alignment - 1)) - address);
+}
+
+}
+
+Arena::Arena(size_t block_bytes, bool huge_pages) :
+             block_bytes_(max(block_bytes, size_t(4096))), huge_pages_(huge_pages) {
+    if (huge_pages_)
+        block_bytes_ = (block_bytes_ + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+}
+
+Arena::~Arena() {
+    for (auto iter = blocks_.begin(); iter != blocks_.end(); ++iter) {
+#if defined(__linux__)
+        if (iter->mapped) {
+            munmap(iter->data, iter->size);
+            continue;
+        }
+#endif
+        ::operator delete(iter->data);
+    }
+}
+
+void Arena::addBlock(size_t bytes) {
+    Block block;
+    block.size = max(bytes, block_bytes_);
+    block.data = nullptr;
+    block.mapped = false;
+#if defined(__linux__)
+    if (huge_pages_) {
+        block.size = (block.size + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+        void* data = mmap(nullptr, block.size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(data, block.size, MADV_HUGEPAGE);
+#endif
+            block.data = static_cast<char*>(data);
+            block.mapped = true;
+        }
+    }
+#endif
+    // Without huge pages, or when mapping fails, blocks come from the heap
+    if (block.data == nullptr)
+        block.data = static_cast<char*>(::operator new(block.size));
+    blocks_.push_back(block);
+    offset_ = 0;
+}
+
+void* Arena::allocate(size_t bytes, size_t alignment) {
+    // Heap blocks are only aligned for fundamental types, so the address
+    // itself is aligned rather than the offset into the block
+    size_t start = 0;
+    if (!blocks_.empty())
+        start = getAlignedOffset(blocks_.back().data, offset_, alignment);
+    if (blocks_.empty() || start + bytes > blocks_.back().size) {
+        addBlock(bytes + alignment - 1);
+        start = getAlignedOffset(blocks_.back().data, 0, alignment);
+    }
+    used_bytes_ += start + bytes - offset_;
+    offset_ = start + bytes;
+    return blocks_.back().data + start;
+}
+
+size_t Arena::getBlockBytes() const {
+    return block_bytes_;
+}
+
+size_t Arena::getBlockCount() const {
+    return blocks_.size();
+}
+
+size_t Arena::getReservedBytes() const {
+    size_t bytes = 0;
+    for (auto iter = blocks_.begin(); iter != blocks_.end(); ++iter) {
+        bytes += iter->size;
+    }
+    return bytes;
+}
+
+size_t Arena::getUsedBytes() const {
+    return used_bytes_;
+}
+
+
+#endif /* KD_ARENA_CPP_ */
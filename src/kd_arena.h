@@ -0,0 +1,151 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_ARENA_H_
+#define KD_ARENA_H_
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <stddef.h>
+
+// Region allocator: memory is carved out of a few large blocks and only
+// released, all at once, when the arena is destroyed. Blocks may be
+// backed by transparent huge pages on Linux. An arena is not thread safe:
+// allocation takes no lock, so threads that build at the same time each
+// allocate from an arena of their own.
+class Arena {
+public:
+    explicit Arena(size_t block_bytes = size_t(1) << 20, bool huge_pages = false);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Memory for bytes bytes, aligned to alignment (a power of two)
+    void* allocate(size_t bytes, size_t alignment);
+
+    size_t getBlockBytes() const;      // Smallest size of a block
+    size_t getBlockCount() const;
+    size_t getReservedBytes() const;   // Total size of all blocks
+    size_t getUsedBytes() const;       // Bytes handed out, with padding
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+        bool mapped;    // Allocated with mmap rather than operator new
+    };
+
+    // Add a block of at least bytes bytes and make it current
+    void addBlock(size_t bytes);
+
+    size_t block_bytes_;
+    bool huge_pages_;
+    std::vector<Block> blocks_;
+    size_t offset_ = 0;         // First free byte of the last block
+    size_t used_bytes_ = 0;
+};
+
+// Standard allocator drawing from an Arena, for containers inside objects
+// that keep the arena alive (such as the Points of tree nodes).
+// Deallocation is a no-op. Without an arena it uses the heap. Copies of a
+// container go to the heap so they never outlive the arena.
+template <typename U>
+class ArenaAllocator {
+public:
+    typedef U value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() noexcept : arena_(nullptr) {}
+    explicit ArenaAllocator(Arena* arena) noexcept : arena_(arena) {}
+    template <typename V>
+    ArenaAllocator(const ArenaAllocator<V>& other) noexcept : arena_(other.getArena()) {}
+
+    U* allocate(size_t count) {
+        if (arena_ == nullptr)
+            return static_cast<U*>(::operator new(count*sizeof(U)));
+        return static_cast<U*>(arena_->allocate(count*sizeof(U), alignof(U)));
+    }
+
+    void deallocate(U* ptr, size_t) noexcept {
+        if (arena_ == nullptr)
+            ::operator delete(ptr);
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const {
+        return ArenaAllocator();
+    }
+
+    Arena* getArena() const { return arena_; }
+
+private:
+    Arena* arena_;
+};
+
+template <typename U, typename V>
+bool operator== (const ArenaAllocator<U>& alloc1, const ArenaAllocator<V>& alloc2) {
+    return alloc1.getArena() == alloc2.getArena();
+}
+
+template <typename U, typename V>
+bool operator!= (const ArenaAllocator<U>& alloc1, const ArenaAllocator<V>& alloc2) {
+    return !(alloc1 == alloc2);
+}
+
+// Allocator for std::allocate_shared that keeps its arena alive for as
+// long as the object it allocated, so shared nodes can outlive their tree
+template <typename U>
+class SharedArenaAllocator {
+public:
+    typedef U value_type;
+
+    explicit SharedArenaAllocator(const std::shared_ptr<Arena>& arena) noexcept : arena_(arena) {}
+    template <typename V>
+    SharedArenaAllocator(const SharedArenaAllocator<V>& other) noexcept
+        : arena_(other.getArena()) {}
+
+    U* allocate(size_t count) {
+        return static_cast<U*>(arena_->allocate(count*sizeof(U), alignof(U)));
+    }
+
+    void deallocate(U*, size_t) noexcept {}
+
+    const std::shared_ptr<Arena>& getArena() const { return arena_; }
+
+private:
+    std::shared_ptr<Arena> arena_;
+};
+
+template <typename U, typename V>
+bool operator== (const SharedArenaAllocator<U>& alloc1, const SharedArenaAllocator<V>& alloc2) {
+    return alloc1.getArena() == alloc2.getArena();
+}
+
+template <typename U, typename V>
+bool operator!= (const SharedArenaAllocator<U>& alloc1, const SharedArenaAllocator<V>& alloc2) {
+    return !(alloc1 == alloc2);
+}
+
+#endif // KD_ARENA_H_ //
@@ -0,0 +1,211 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_COMPACT_TREE_CPP_
+#define KD_COMPACT_TREE_CPP_
+
+#include <vector>
+#include <limits>
+#include <cmath>
+#include <cassert>
+#include <type_traits>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_compact_tree.h"
+
+using namespace std;
+
+template <typename T, typename S>
+S CompactKdTree<T, S>::roundDown(const T& split_position) {
+    S rounded = S(split_position);
+    if (T(rounded) > split_position)
+        rounded = nextafter(rounded, -numeric_limits<S>::infinity());
+    return rounded;
+}
+
+template <typename T, typename S>
+T CompactKdTree<T, S>::getSplitUpper(const uint32_t& node) const {
+    S split_position = split_positions_[node];
+    if (is_same<S, T>::value)
+        return T(split_position);
+    return T(nextafter(split_position, numeric_limits<S>::infinity()));
+}
+
+template <typename T, typename S>
+void CompactKdTree<T, S>::appendPreorder(const KdTreeNode<T>& node) {
+    uint32_t id = split_positions_.size();
+    assert(node.split_axis <= axis_mask_);
+    split_positions_.push_back(roundDown(node.split_position));
+    right_children_.push_back(0);
+    axis_flags_.push_back(uint16_t(node.split_axis));
+    coords_.insert(coords_.end(), node.point.begin(), node.point.end());
+    ids_.push_back(node.point.getIndex());
+
+    if (node.left_child != nullptr) {
+        axis_flags_[id] |= has_left_flag_;
+        appendPreorder(*node.left_child);
+    }
+    if (node.right_child != nullptr) {
+        right_children_[id] = split_positions_.size();
+        appendPreorder(*node.right_child);
+    }
+}
+
+template <typename T, typename S>
+CompactKdTree<T, S> CompactKdTree<T, S>::encode(const KdTree<T>& source) {
+    CompactKdTree<T, S> compact;
+    compact.metric_ = source.getMetric();
+    compact.max_norm_ = source.getMaxNorm();
+    compact.rotation_ = source.getRotation();
+
+    KdTree<T> tree = source;
+    if (!tree.isEmpty() && tree.getRootNode().deleted_count > 0)
+        tree.compact();
+    if (tree.isEmpty())
+        return compact;
+
+    KdTreeNode<T> root = tree.getRootNode();
+    compact.dimension_ = root.point.getDimension();
+    compact.split_positions_.reserve(root.size);
+    compact.right_children_.reserve(root.size);
+    compact.axis_flags_.reserve(root.size);
+    compact.coords_.reserve(root.size*compact.dimension_);
+    compact.ids_.reserve(root.size);
+    compact.appendPreorder(root);
+    return compact;
+}
+
+template <typename T, typename S>
+size_t CompactKdTree<T, S>::getNodeCount() const {
+    return split_positions_.size();
+}
+
+template <typename T, typename S>
+size_t CompactKdTree<T, S>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T, typename S>
+bool CompactKdTree<T, S>::isEmpty() const {
+    return split_positions_.empty();
+}
+
+template <typename T, typename S>
+double CompactKdTree<T, S>::getNodeBytesPerPoint() const {
+    return double(sizeof(S) + sizeof(uint32_t) + sizeof(uint16_t));
+}
+
+template <typename T, typename S>
+double CompactKdTree<T, S>::getBytesPerPoint() const {
+    return getNodeBytesPerPoint() + double(dimension_*sizeof(T) + sizeof(size_t));
+}
+
+template <typename T, typename S>
+void CompactKdTree<T, S>::getNearestNeighbor(const uint32_t& node, const T* query,
+                                             uint32_t& best_point, T& best_dist) const {
+    const T* pt = &coords_[size_t(node)*dimension_];
+    T distance = T(0);
+    for (size_t axis = 0; axis < dimension_; ++axis) {
+        T diff = pt[axis] - query[axis];
+        distance += diff*diff;
+    }
+    if (distance < best_dist) {
+        best_dist = distance;
+        best_point = node;
+    }
+
+    uint16_t axis_flags = axis_flags_[node];
+    uint32_t left_child = (axis_flags & has_left_flag_) ? node+1 : 0;
+    uint32_t right_child = right_children_[node];
+    if (left_child == 0 && right_child == 0)
+        return;
+
+    // Left of the split lies below split_upper, right of it at or above split_lower
+    T coord = query[axis_flags & axis_mask_];
+    T split_lower = T(split_positions_[node]);
+    bool left_first = coord < split_lower;
+    uint32_t near_child = left_first ? left_child : right_child;
+    uint32_t far_child = left_first ? right_child : left_child;
+    T far_gap = left_first ? split_lower - coord : max(coord - getSplitUpper(node), T(0));
+    if (near_child != 0)
+        getNearestNeighbor(near_child, query, best_point, best_dist);
+    if (far_child != 0 && far_gap*far_gap < best_dist)
+        getNearestNeighbor(far_child, query, best_point, best_dist);
+}
+
+template <typename T, typename S>
+pair<size_t, T> CompactKdTree<T, S>::findNearest(const Point<T>& query) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    Point<T> rotated = rotation_.empty() ? query : rotatePoint(rotation_, query);
+    vector<T> search_query = (metric_ == KdTree<T>::Metric_t::EUCLIDEAN) ? rotated.getPointVector()
+        : KdTree<T>::transformPoint(rotated, metric_, max_norm_, true).getPointVector();
+    uint32_t best_point = 0;
+    T best_dist = numeric_limits<T>::max();
+    getNearestNeighbor(0, search_query.data(), best_point, best_dist);
+    return make_pair(ids_[best_point],
+                     KdTree<T>::transformScore(sqrt(best_dist), query, metric_, max_norm_));
+}
+
+template <typename T, typename S>
+void CompactKdTree<T, S>::queryCompactKdTree(const CompactKdTree<T, S>& tree,
+                                             const vector<Point<T>*>& query_points) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = tree.findNearest(**iter);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T, typename S>
+void CompactKdTree<T, S>::queryCompactKdTree(const CompactKdTree<T, S>& tree,
+                                             const PointSet<T>& query_points) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = tree.findNearest(query_points[i].toPoint());
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class CompactKdTree<float, float>;
+template class CompactKdTree<double, double>;
+template class CompactKdTree<double, float>;
+
+
+#endif /* KD_COMPACT_TREE_CPP_ */
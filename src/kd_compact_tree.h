@@ -0,0 +1,102 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_COMPACT_TREE_H_
+#define KD_COMPACT_TREE_H_
+
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+
+// Static KD-tree with a compact node encoding. Nodes are stored in
+// preorder, so a node's left child is the next node and its Point has the
+// node's own offset; neither is stored, and depth is dropped. Each node
+// keeps only its split position (as S, which may be float for a double
+// tree), a 32-bit right child offset and a 16-bit word holding the split
+// axis and a left child flag. The fields live in separate arrays.
+// The index is in memory only: it has no file format, and the command line
+// encodes one from a saved KD-tree only to report its size (--flatten).
+template <typename T=double, typename S=T>
+class CompactKdTree {
+private:
+    static const uint16_t has_left_flag_ = 0x8000;
+    static const uint16_t axis_mask_ = 0x7FFF;
+
+    size_t dimension_ = 0;
+    std::vector<S> split_positions_;
+    std::vector<uint32_t> right_children_;  // 0 when absent (0 is the root)
+    std::vector<uint16_t> axis_flags_;
+    std::vector<T> coords_;                 // Row-major Point coordinates
+    std::vector<size_t> ids_;               // Input file index of each Point
+    typename KdTree<T>::Metric_t metric_ = KdTree<T>::Metric_t::EUCLIDEAN;
+    T max_norm_ = T(0);
+    std::vector<T> rotation_;               // PCA rotation of the source tree, if any
+
+    // Copy a pointer-based subtree into preorder
+    void appendPreorder(const KdTreeNode<T>& node);
+
+    // Split positions rounded down to S, and the next S value above them.
+    // Points left of the true split lie below the upper value and Points
+    // right of it lie at or above the lower value.
+    static S roundDown(const T& split_position);
+    T getSplitUpper(const uint32_t& node) const;
+
+    // Recursively find nearest neighbor. Distances are squared.
+    void getNearestNeighbor(const uint32_t& node, const T* query,
+                            uint32_t& best_point, T& best_dist) const;
+
+public:
+    // Constructors/Destructor
+    CompactKdTree() = default;
+    ~CompactKdTree() = default;
+
+    // Encode a built KD-tree. Erased points are dropped first.
+    static CompactKdTree<T, S> encode(const KdTree<T>& tree);
+
+    // Member functions
+    size_t getNodeCount() const;
+    size_t getDimension() const;
+    bool isEmpty() const;
+
+    // Bytes per Point taken by the node encoding, and by the whole index
+    double getNodeBytesPerPoint() const;
+    double getBytesPerPoint() const;
+
+    // Find the nearest neighbor of a single query under the tree's metric.
+    // Returns {point index, score}.
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Query compact KD tree for a set of points
+    static void queryCompactKdTree(const CompactKdTree<T, S>& tree,
+                                   const std::vector<Point<T>*>& query_points);
+    static void queryCompactKdTree(const CompactKdTree<T, S>& tree,
+                                   const PointSet<T>& query_points);
+};
+
+
+#include "kd_compact_tree.cpp"
+
+#endif /* KD_COMPACT_TREE_H_ */
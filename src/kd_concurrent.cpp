@@ -0,0 +1,160 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_CONCURRENT_CPP_
+#define KD_CONCURRENT_CPP_
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <limits>
+#include <algorithm>
+#include "kd_tree.h"
+#include "kd_concurrent.h"
+
+using namespace std;
+
+template <typename T>
+ConcurrentKdTree<T>::ReadGuard::ReadGuard(const ConcurrentKdTree<T>& owner) :
+                                          owner_(owner), slot_(0), snapshot_(nullptr) {
+    // Claim a free slot with the current epoch, then load the version.
+    // Anything published before that epoch was retired no earlier than it.
+    uint64_t epoch = owner_.global_epoch_.load();
+    for (;;) {
+        uint64_t free_slot = 0;
+        if (owner_.reader_slots_[slot_].epoch.compare_exchange_weak(free_slot, epoch))
+            break;
+        if (++slot_ == max_readers_) {
+            slot_ = 0;
+            this_thread::yield();
+            epoch = owner_.global_epoch_.load();
+        }
+    }
+    snapshot_ = owner_.published_.load();
+}
+
+template <typename T>
+ConcurrentKdTree<T>::ReadGuard::~ReadGuard() {
+    owner_.reader_slots_[slot_].epoch.store(0, memory_order_release);
+}
+
+template <typename T>
+const KdTree<T>& ConcurrentKdTree<T>::ReadGuard::getTree() const {
+    return *snapshot_;
+}
+
+template <typename T>
+ConcurrentKdTree<T>::ConcurrentKdTree(const KdTree<T>& tree) :
+                                      writer_tree_(tree.clone()), global_epoch_(1) {
+    writer_tree_.setCopyOnWrite(true);
+    for (size_t i = 0; i < max_readers_; ++i) {
+        reader_slots_[i].epoch.store(0);
+    }
+    published_.store(new KdTree<T>(writer_tree_));
+}
+
+template <typename T>
+ConcurrentKdTree<T>::~ConcurrentKdTree() {
+    delete published_.load();
+    for (auto iter = retired_.begin(); iter != retired_.end(); ++iter) {
+        delete iter->second;
+    }
+}
+
+template <typename T>
+void ConcurrentKdTree<T>::publish() {
+    const KdTree<T>* previous = published_.exchange(new KdTree<T>(writer_tree_));
+    retired_.push_back(make_pair(global_epoch_.fetch_add(1), previous));
+    reclaim();
+}
+
+template <typename T>
+void ConcurrentKdTree<T>::reclaim() {
+    uint64_t oldest_reader = numeric_limits<uint64_t>::max();
+    for (size_t i = 0; i < max_readers_; ++i) {
+        uint64_t epoch = reader_slots_[i].epoch.load();
+        if (epoch != 0)
+            oldest_reader = min(oldest_reader, epoch);
+    }
+
+    // Nodes shared with newer versions stay alive through their shared_ptrs
+    auto keep = retired_.begin();
+    for (auto iter = retired_.begin(); iter != retired_.end(); ++iter) {
+        if (iter->first < oldest_reader)
+            delete iter->second;
+        else
+            *keep++ = *iter;
+    }
+    retired_.erase(keep, retired_.end());
+}
+
+template <typename T>
+void ConcurrentKdTree<T>::insert(const Point<T>& point) {
+    lock_guard<mutex> lock(writer_mutex_);
+    writer_tree_.insert(point);
+    publish();
+}
+
+template <typename T>
+bool ConcurrentKdTree<T>::erase(const size_t& index) {
+    lock_guard<mutex> lock(writer_mutex_);
+    if (!writer_tree_.erase(index))
+        return false;
+    publish();
+    return true;
+}
+
+template <typename T>
+bool ConcurrentKdTree<T>::erase(const Point<T>& point) {
+    lock_guard<mutex> lock(writer_mutex_);
+    if (!writer_tree_.erase(point))
+        return false;
+    publish();
+    return true;
+}
+
+template <typename T>
+void ConcurrentKdTree<T>::compact() {
+    lock_guard<mutex> lock(writer_mutex_);
+    writer_tree_.compact();
+    publish();
+}
+
+template <typename T>
+pair<size_t, T> ConcurrentKdTree<T>::findNearest(const Point<T>& query) const {
+    ReadGuard guard(*this);
+    return KdTree<T>::findNearest(guard.getTree(), query);
+}
+
+template <typename T>
+size_t ConcurrentKdTree<T>::getRetiredCount() {
+    lock_guard<mutex> lock(writer_mutex_);
+    reclaim();
+    return retired_.size();
+}
+
+template class ConcurrentKdTree<float>;
+template class ConcurrentKdTree<double>;
+
+
+#endif /* KD_CONCURRENT_CPP_ */
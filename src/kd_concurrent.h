@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_CONCURRENT_H_
+#define KD_CONCURRENT_H_
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+
+// KD-tree that serves queries while it is being updated. Writers apply
+// copy-on-write updates to a private KdTree and publish each new version
+// through an atomic pointer; unchanged subtrees are shared between
+// versions. Readers never lock: they announce the epoch they started in,
+// load the current version and search it. A retired version is released
+// only once every active reader started after it was replaced.
+template <typename T=double>
+class ConcurrentKdTree {
+public:
+    // Pins the current version for as long as the guard lives
+    class ReadGuard {
+    private:
+        const ConcurrentKdTree<T>& owner_;
+        size_t slot_;
+        const KdTree<T>* snapshot_;
+    public:
+        explicit ReadGuard(const ConcurrentKdTree<T>& owner);
+        ~ReadGuard();
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const KdTree<T>& getTree() const;
+    };
+
+    static const size_t max_readers_ = 64;
+
+private:
+    // Epoch announced by a reader, 0 when the slot is free.
+    // Padded so that readers do not share cache lines.
+    struct alignas(64) ReaderSlot {
+        std::atomic<uint64_t> epoch;
+    };
+
+    KdTree<T> writer_tree_;                     // Latest version, writers only
+    std::atomic<const KdTree<T>*> published_;
+    std::atomic<uint64_t> global_epoch_;
+    mutable ReaderSlot reader_slots_[max_readers_];
+    std::mutex writer_mutex_;
+    std::vector<std::pair<uint64_t, const KdTree<T>*>> retired_;
+
+    // Publish writer_tree_ and release versions no reader can still see
+    void publish();
+    void reclaim();
+
+public:
+    // Constructors/Destructor. The tree is deep copied, so later updates
+    // to the caller's KdTree do not reach the published versions.
+    explicit ConcurrentKdTree(const KdTree<T>& tree = KdTree<T>());
+    ~ConcurrentKdTree();
+    ConcurrentKdTree(const ConcurrentKdTree&) = delete;
+    ConcurrentKdTree& operator=(const ConcurrentKdTree&) = delete;
+
+    // Writers (serialized among themselves, never block readers)
+    void insert(const Point<T>& point);
+    bool erase(const size_t& index);
+    bool erase(const Point<T>& point);
+    void compact();
+
+    // Readers. Returns {point index, score} from a consistent snapshot.
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Number of replaced versions still waiting for readers to finish
+    size_t getRetiredCount();
+};
+
+
+#include "kd_concurrent.cpp"
+
+#endif /* KD_CONCURRENT_H_ */
@@ -0,0 +1,153 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_DYNAMIC_CPP_
+#define KD_DYNAMIC_CPP_
+
+#include <vector>
+#include <limits>
+#include <memory>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_dynamic.h"
+
+using namespace std;
+
+template <typename T>
+DynamicKdTree<T>::DynamicKdTree(const size_t& buffer_capacity) :
+                                buffer_capacity_(buffer_capacity > 0 ? buffer_capacity : 1) {
+    buffer_.reserve(buffer_capacity_);
+}
+
+template <typename T>
+void DynamicKdTree<T>::insert(const Point<T>& point) {
+    buffer_.push_back(point);
+    if (buffer_.size() < buffer_capacity_)
+        return;
+
+    // Carry the buffer into the first empty level, merging the full ones
+    vector<Point<T>> merged;
+    merged.swap(buffer_);
+    size_t level = 0;
+    for (; level < levels_.size() && !levels_[level].isEmpty(); ++level) {
+        vector<Point<T>> level_points = levels_[level].getPoints();
+        merged.insert(merged.end(), level_points.begin(), level_points.end());
+        levels_[level] = KdTree<T>();
+    }
+    if (level == levels_.size())
+        levels_.push_back(KdTree<T>());
+
+    vector<Point<T>*> merged_ptrs;
+    merged_ptrs.reserve(merged.size());
+    for (auto iter = merged.begin(); iter != merged.end(); ++iter) {
+        merged_ptrs.push_back(&(*iter));
+    }
+    levels_[level] = KdTree<T>(KdTree<T>::treeBuild(merged_ptrs, 0));
+    buffer_.reserve(buffer_capacity_);
+}
+
+template <typename T>
+size_t DynamicKdTree<T>::size() const {
+    size_t total = buffer_.size();
+    for (auto iter = levels_.begin(); iter != levels_.end(); ++iter) {
+        total += iter->size();
+    }
+    return total;
+}
+
+template <typename T>
+size_t DynamicKdTree<T>::getLevelCount() const {
+    return levels_.size();
+}
+
+template <typename T>
+bool DynamicKdTree<T>::isEmpty() const {
+    return size() == 0;
+}
+
+template <typename T>
+pair<size_t, T> DynamicKdTree<T>::findNearest(const Point<T>& query) const {
+    T bestDist = numeric_limits<T>::max();
+    size_t bestIndex = numeric_limits<size_t>::max();
+
+    for (auto iter = buffer_.begin(); iter != buffer_.end(); ++iter) {
+        T distance = getDistance(*iter, query);
+        if (distance < bestDist) {
+            bestDist = distance;
+            bestIndex = iter->getIndex();
+        }
+    }
+
+    // Larger levels last, so the bound from the small ones prunes them.
+    // Levels are Euclidean, so their scores are distances.
+    for (auto iter = levels_.begin(); iter != levels_.end(); ++iter) {
+        Point<T> hint;
+        pair<size_t, T> nearest = KdTree<T>::findNearest(*iter, query, hint, bestDist);
+        if (nearest.first != numeric_limits<size_t>::max()) {
+            bestIndex = nearest.first;
+            bestDist = nearest.second;
+        }
+    }
+    return make_pair(bestIndex, bestDist);
+}
+
+template <typename T>
+void DynamicKdTree<T>::queryDynamicKdTree(const DynamicKdTree<T>& tree,
+                                          const vector<Point<T>*>& query_points) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = tree.findNearest(**iter);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+void DynamicKdTree<T>::queryDynamicKdTree(const DynamicKdTree<T>& tree,
+                                          const PointSet<T>& query_points) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = tree.findNearest(query_points[i].toPoint());
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class DynamicKdTree<float>;
+template class DynamicKdTree<double>;
+
+
+#endif /* KD_DYNAMIC_CPP_ */
@@ -0,0 +1,72 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_DYNAMIC_H_
+#define KD_DYNAMIC_H_
+
+#include <vector>
+#include <utility>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+
+// Dynamic index built from static KD-trees using the logarithmic method
+// (Bentley-Saxe). New Points go to a small buffer; when it fills, the
+// buffer and all full levels below the first empty level are merged into
+// one static tree at that level. Level i holds either no Points or
+// buffer_capacity * 2^i of them, so each Point is rebuilt O(log n) times.
+// Levels are plain Euclidean trees built with treeBuild: PCA rotation,
+// Morton presorting and lazy or arena builds do not apply to them.
+template <typename T=double>
+class DynamicKdTree {
+private:
+    std::vector<Point<T>> buffer_;      // Recent inserts, scanned linearly
+    std::vector<KdTree<T>> levels_;     // Static trees, empty or full
+    size_t buffer_capacity_;
+
+public:
+    // Constructors/Destructor
+    DynamicKdTree(const size_t& buffer_capacity = 64);
+    ~DynamicKdTree() = default;
+
+    // Member functions
+    void insert(const Point<T>& point);
+    size_t size() const;
+    size_t getLevelCount() const;
+    bool isEmpty() const;
+
+    // Nearest neighbor over the buffer and every level, sharing one bound.
+    // Returns {point index, distance}.
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Query the dynamic tree for a set of points
+    static void queryDynamicKdTree(const DynamicKdTree<T>& tree,
+                                   const std::vector<Point<T>*>& query_points);
+    static void queryDynamicKdTree(const DynamicKdTree<T>& tree,
+                                   const PointSet<T>& query_points);
+};
+
+
+#include "kd_dynamic.cpp"
+
+#endif /* KD_DYNAMIC_H_ */
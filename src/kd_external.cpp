@@ -0,0 +1,384 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_EXTERNAL_CPP_
+#define KD_EXTERNAL_CPP_
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cmath>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_external.h"
+
+using namespace std;
+
+// SET SAMPLE SIZE FOR THE TOP LEVEL SPLITS HERE
+template <typename T>
+size_t ExternalKdTreeBuilder<T>::sample_size_ = 1 << 20;
+
+// SET LARGEST RUN BUILT IN MEMORY HERE
+template <typename T>
+size_t ExternalKdTreeBuilder<T>::partition_points_ = 1 << 24;
+
+// SET RANDOM SEED OF THE SAMPLE HERE
+template <typename T>
+unsigned int ExternalKdTreeBuilder<T>::random_seed_ = 1;
+
+namespace {
+
+// Write records at a byte offset of the output file
+template <typename V>
+void writeAt(ofstream& out_stream, const uint64_t& offset, const vector<V>& records) {
+    out_stream.seekp(offset);
+    out_stream.write(reinterpret_cast<const char*>(records.data()), records.size()*sizeof(V));
+    if (!out_stream.good())
+        throw runtime_error("Cannot write flat KD-tree file");
+}
+
+}
+
+template <typename T>
+ExternalKdTreeBuilder<T>::RunFiles::~RunFiles() {
+    for (size_t partition = 0; partition < count; ++partition) {
+        string run_file = prefix + "." + to_string(partition);
+        remove(run_file.c_str());
+    }
+}
+
+template <typename T>
+size_t ExternalKdTreeBuilder<T>::buildSkeleton(const vector<Point<T>*>& sample, const double& scale,
+                                               const size_t depth, vector<SkeletonNode>& skeleton,
+                                               size_t& partitions) {
+    size_t index = skeleton.size();
+    skeleton.push_back(SkeletonNode());
+    skeleton[index].depth = depth;
+    if (sample.size() < 2 || double(sample.size())*scale <= double(partition_points_)) {
+        skeleton[index].is_partition = true;
+        skeleton[index].partition = partitions++;
+        return index;
+    }
+
+    // Split at the sample median, on the first sampled point that holds it
+    // so that the pivot is an input point
+    vector<Point<T>> distro_params = getDistributionParams(sample);
+    size_t split_axis = KdTree<T>::getSplitAxis(distro_params, depth);
+    T split_position = getExactMedian(sample, split_axis);
+    Point<T>* pivot = nullptr;
+    vector<Point<T>*> l_sample, r_sample;
+    for (auto iter = sample.begin(); iter != sample.end(); ++iter) {
+        if (pivot == nullptr && (**iter)[split_axis] == split_position) {
+            pivot = *iter;
+            continue;
+        }
+        if ((**iter)[split_axis] < split_position)
+            l_sample.push_back(*iter);
+        else
+            r_sample.push_back(*iter);
+    }
+    skeleton[index].split_axis = split_axis;
+    skeleton[index].split_position = split_position;
+    skeleton[index].point = pivot->getPointVector();
+    skeleton[index].id = pivot->getIndex();
+
+    size_t left = buildSkeleton(l_sample, scale, depth+1, skeleton, partitions);
+    skeleton[index].left = left;
+    size_t right = buildSkeleton(r_sample, scale, depth+1, skeleton, partitions);
+    skeleton[index].right = right;
+    return index;
+}
+
+template <typename T>
+vector<T> ExternalKdTreeBuilder<T>::writeSubtree(const vector<SkeletonNode>& skeleton,
+                                                 const size_t& node, const uint32_t& position,
+                                                 const size_t& dimension, const string& run_prefix,
+                                                 const vector<uint64_t>& offsets,
+                                                 ofstream& out_stream) {
+    const SkeletonNode& skeleton_node = skeleton[node];
+    vector<T> bounds;
+    if (skeleton_node.count == 0)
+        return bounds;
+
+    if (skeleton_node.is_partition) {
+        // Load the run, numbering its points by run position
+        string run_file = run_prefix + "." + to_string(skeleton_node.partition);
+        ifstream run_stream(run_file, ios::binary);
+        vector<Point<T>> points;
+        vector<uint64_t> ids(skeleton_node.count);
+        points.reserve(skeleton_node.count);
+        vector<T> coords(dimension);
+        for (size_t i = 0; i < skeleton_node.count; ++i) {
+            run_stream.read(reinterpret_cast<char*>(coords.data()), dimension*sizeof(T));
+            run_stream.read(reinterpret_cast<char*>(&ids[i]), sizeof(uint64_t));
+            points.push_back(Point<T>(coords, int(i)));
+        }
+        if (!run_stream.good())
+            throw runtime_error("Cannot read run file: " + run_file);
+        run_stream.close();
+        remove(run_file.c_str());
+
+        vector<Point<T>*> point_ptrs;
+        point_ptrs.reserve(points.size());
+        for (auto iter = points.begin(); iter != points.end(); ++iter) {
+            point_ptrs.push_back(&(*iter));
+        }
+        KdTree<T> subtree(KdTree<T>::treeBuild(point_ptrs, skeleton_node.depth));
+        FlatKdTree<T> flat = FlatKdTree<T>::flatten(subtree, FlatKdTree<T>::Layout_t::PREORDER);
+
+        // Offsets become positions in the whole tree, and run positions
+        // input file indexes
+        for (auto iter = flat.nodes_.begin(); iter != flat.nodes_.end(); ++iter) {
+            iter->point += position;
+            if (iter->left_child != FlatKdTree<T>::null_node_)
+                iter->left_child += position;
+            if (iter->right_child != FlatKdTree<T>::null_node_)
+                iter->right_child += position;
+        }
+        for (auto iter = flat.ids_.begin(); iter != flat.ids_.end(); ++iter) {
+            *iter = ids[*iter];
+        }
+        writeAt(out_stream, offsets[0] + position*sizeof(FlatKdNode<T>), flat.nodes_);
+        writeAt(out_stream, offsets[1] + position*dimension*sizeof(T), flat.coords_);
+        writeAt(out_stream, offsets[2] + position*sizeof(size_t), flat.ids_);
+        if (!flat.bounds_.empty()) {
+            writeAt(out_stream, offsets[3] + position*2*dimension*sizeof(T), flat.bounds_);
+            bounds.assign(flat.bounds_.begin(), flat.bounds_.begin() + 2*dimension);
+        }
+        return bounds;
+    }
+
+    // Children follow in preorder
+    uint32_t left_position = position + 1;
+    uint32_t right_position = left_position + skeleton[skeleton_node.left].count;
+    vector<T> l_bounds = writeSubtree(skeleton, skeleton_node.left, left_position, dimension,
+                                      run_prefix, offsets, out_stream);
+    vector<T> r_bounds = writeSubtree(skeleton, skeleton_node.right, right_position, dimension,
+                                      run_prefix, offsets, out_stream);
+
+    vector<FlatKdNode<T>> flat_node(1);
+    flat_node[0].split_position = skeleton_node.split_position;
+    flat_node[0].split_axis = skeleton_node.split_axis;
+    flat_node[0].point = position;
+    flat_node[0].left_child = (skeleton[skeleton_node.left].count > 0) ? left_position
+                                                                       : FlatKdTree<T>::null_node_;
+    flat_node[0].right_child = (skeleton[skeleton_node.right].count > 0) ? right_position
+                                                                         : FlatKdTree<T>::null_node_;
+    writeAt(out_stream, offsets[0] + position*sizeof(FlatKdNode<T>), flat_node);
+    writeAt(out_stream, offsets[1] + position*dimension*sizeof(T), skeleton_node.point);
+    writeAt(out_stream, offsets[2] + position*sizeof(size_t), vector<size_t>(1, skeleton_node.id));
+
+    if (KdTree<T>::tight_bounds_) {
+        bounds = skeleton_node.point;
+        bounds.insert(bounds.end(), skeleton_node.point.begin(), skeleton_node.point.end());
+        for (const vector<T>* child : {&l_bounds, &r_bounds}) {
+            if (child->empty())
+                continue;
+            for (size_t axis = 0; axis < dimension; ++axis) {
+                bounds[axis] = min(bounds[axis], (*child)[axis]);
+                bounds[dimension+axis] = max(bounds[dimension+axis], (*child)[dimension+axis]);
+            }
+        }
+        writeAt(out_stream, offsets[3] + position*2*dimension*sizeof(T), bounds);
+    }
+    return bounds;
+}
+
+template <typename T>
+size_t ExternalKdTreeBuilder<T>::buildFromFile(const string& input_file, const string& output_file,
+                                               const typename KdTree<T>::Metric_t& metric,
+                                               const string& run_prefix) {
+    string prefix = run_prefix.empty() ? output_file + ".run" : run_prefix;
+
+    // First pass: point count, largest norm and a reservoir sample
+    ifstream input_stream(input_file);
+    if (!input_stream.good())
+        throw runtime_error("Cannot open input file: " + input_file);
+    mt19937 rng(random_seed_);
+    vector<vector<T>> sample_coords;
+    vector<size_t> sample_ids;
+    vector<T> coords;
+    size_t line = 0;
+    size_t count = 0;
+    size_t input_dimension = 0;
+    T max_norm = T(0);
+    while (FileHandler<T>::csvReadNext(input_stream, coords)) {
+        size_t id = line++;
+        if (coords.empty())
+            continue;
+        if (input_dimension == 0)
+            input_dimension = coords.size();
+        else if (coords.size() != input_dimension)
+            throw runtime_error("Inconsistent dimension on line " + to_string(line) + " of " + input_file);
+        ++count;
+        if (metric == KdTree<T>::Metric_t::INNER_PRODUCT)
+            max_norm = max(max_norm, getNorm(Point<T>(coords)));
+
+        if (sample_coords.size() < sample_size_) {
+            sample_coords.push_back(coords);
+            sample_ids.push_back(id);
+            continue;
+        }
+        uniform_int_distribution<size_t> pick(0, count-1);
+        size_t slot = pick(rng);
+        if (slot < sample_size_) {
+            sample_coords[slot] = coords;
+            sample_ids[slot] = id;
+        }
+    }
+    input_stream.close();
+    if (count >= FlatKdTree<T>::null_node_)
+        throw runtime_error("Too many points for a flat KD-tree file: " + input_file);
+
+    // With pca_rotation_, the principal axes are those of the sample
+    vector<T> rotation;
+    if (KdTree<T>::pca_rotation_ && !sample_coords.empty()) {
+        vector<Point<T>> pca_points;
+        vector<Point<T>*> pca_ptrs;
+        pca_points.reserve(sample_coords.size());
+        for (auto iter = sample_coords.begin(); iter != sample_coords.end(); ++iter) {
+            pca_points.push_back(Point<T>(*iter));
+            pca_ptrs.push_back(&pca_points.back());
+        }
+        vector<T> variances;
+        rotation = getPrincipalAxes(pca_ptrs, variances);
+    }
+
+    auto toSearchSpace = [&](const vector<T>& pt) -> vector<T> {
+        if (metric == KdTree<T>::Metric_t::EUCLIDEAN && rotation.empty())
+            return pt;
+        Point<T> rotated = rotation.empty() ? Point<T>(pt) : rotatePoint(rotation, Point<T>(pt));
+        return KdTree<T>::transformPoint(rotated, metric, max_norm, false).getPointVector();
+    };
+
+    // Top levels from the sample; pivots are identified by input file index
+    vector<Point<T>> sample_points;
+    sample_points.reserve(sample_coords.size());
+    for (size_t i = 0; i < sample_coords.size(); ++i) {
+        sample_points.push_back(Point<T>(toSearchSpace(sample_coords[i]), int(i)));
+    }
+    vector<vector<T>>().swap(sample_coords);
+    vector<Point<T>*> sample_ptrs;
+    for (auto iter = sample_points.begin(); iter != sample_points.end(); ++iter) {
+        sample_ptrs.push_back(&(*iter));
+    }
+    vector<SkeletonNode> skeleton;
+    size_t partitions = 0;
+    double scale = sample_points.empty() ? 0.0 : double(count)/double(sample_points.size());
+    buildSkeleton(sample_ptrs, scale, 0, skeleton, partitions);
+    vector<Point<T>>().swap(sample_points);
+
+    vector<size_t> pivot_ids;
+    for (auto iter = skeleton.begin(); iter != skeleton.end(); ++iter) {
+        if (!iter->is_partition) {
+            iter->id = sample_ids[iter->id];
+            pivot_ids.push_back(iter->id);
+        }
+    }
+    sort(pivot_ids.begin(), pivot_ids.end());
+
+    // Second pass: route every other point to the run below the top levels
+    size_t dimension = input_dimension + ((metric == KdTree<T>::Metric_t::INNER_PRODUCT) ? 1 : 0);
+    RunFiles run_files;
+    run_files.prefix = prefix;
+    vector<shared_ptr<ofstream>> runs;
+    for (size_t partition = 0; partition < partitions; ++partition) {
+        string run_file = prefix + "." + to_string(partition);
+        runs.push_back(make_shared<ofstream>(run_file, ios::binary));
+        ++run_files.count;
+        if (!runs.back()->good())
+            throw runtime_error("Cannot create run file: " + run_file);
+    }
+    vector<size_t> partition_counts(partitions, 0);
+    input_stream.open(input_file);
+    line = 0;
+    while (FileHandler<T>::csvReadNext(input_stream, coords)) {
+        uint64_t id = line++;
+        if (coords.empty() || binary_search(pivot_ids.begin(), pivot_ids.end(), id))
+            continue;
+        vector<T> pt = toSearchSpace(coords);
+        size_t node = 0;
+        while (!skeleton[node].is_partition) {
+            node = (pt[skeleton[node].split_axis] < skeleton[node].split_position) ? skeleton[node].left
+                                                                                   : skeleton[node].right;
+        }
+        size_t partition = skeleton[node].partition;
+        runs[partition]->write(reinterpret_cast<const char*>(pt.data()), dimension*sizeof(T));
+        runs[partition]->write(reinterpret_cast<const char*>(&id), sizeof(uint64_t));
+        ++partition_counts[partition];
+    }
+    input_stream.close();
+    for (auto iter = runs.begin(); iter != runs.end(); ++iter) {
+        (*iter)->close();
+    }
+
+    // Children follow their parent in the skeleton, so counts fill bottom-up
+    for (size_t node = skeleton.size(); node-- > 0;) {
+        SkeletonNode& skeleton_node = skeleton[node];
+        skeleton_node.count = skeleton_node.is_partition ? partition_counts[skeleton_node.partition]
+                              : 1 + skeleton[skeleton_node.left].count
+                                  + skeleton[skeleton_node.right].count;
+    }
+
+    // Header, then sections at the offsets FlatKdTree<T> reads them from
+    ofstream out_stream(output_file, ios::binary);
+    if (!out_stream.good())
+        throw runtime_error("Cannot create output file: " + output_file);
+    size_t bounds_size = KdTree<T>::tight_bounds_ ? count*2*dimension : 0;
+    vector<uint64_t> header = {flat_file_magic, sizeof(T), (count > 0) ? dimension : 0, count, count,
+                               bounds_size, uint64_t(metric),
+                               uint64_t(FlatKdTree<T>::Layout_t::PREORDER), 0, rotation.size()};
+    writeSection(out_stream, header);
+    writeSection(out_stream, vector<T>(1, max_norm));
+    writeSection(out_stream, rotation);
+
+    vector<uint64_t> offsets(5);
+    offsets[0] = uint64_t(out_stream.tellp());
+    offsets[1] = alignSection(offsets[0] + count*sizeof(FlatKdNode<T>));
+    offsets[2] = alignSection(offsets[1] + count*dimension*sizeof(T));
+    offsets[3] = alignSection(offsets[2] + count*sizeof(size_t));
+    offsets[4] = alignSection(offsets[3] + bounds_size*sizeof(T));
+    if (count > 0)
+        writeSubtree(skeleton, 0, 0, dimension, prefix, offsets, out_stream);
+
+    // Zero padding after the last section
+    uint64_t data_end = (bounds_size > 0) ? offsets[3] + bounds_size*sizeof(T)
+                                          : offsets[2] + count*sizeof(size_t);
+    vector<char> padding(offsets[4] - data_end, 0);
+    writeAt(out_stream, data_end, padding);
+    out_stream.close();
+    return count;
+}
+
+template class ExternalKdTreeBuilder<float>;
+template class ExternalKdTreeBuilder<double>;
+
+
+#endif /* KD_EXTERNAL_CPP_ */
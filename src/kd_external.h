@@ -0,0 +1,108 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_EXTERNAL_H_
+#define KD_EXTERNAL_H_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+
+// Out-of-core builder for inputs larger than memory. The input file is
+// streamed twice: the first pass draws a random sample, from which the top
+// levels of the tree are split; the second routes every point below those
+// levels into an on-disk run. Each run is then built in memory with
+// KdTree<T>::treeBuild and written into its place in a flat KD-tree file
+// (preorder layout), which FlatKdTree<T> reads as usual. With
+// KdTree<T>::pca_rotation_, the rotation is taken from the sample.
+template <typename T=double>
+class ExternalKdTreeBuilder {
+public:
+    // Number of input points kept by reservoir sampling to choose the top
+    // level splits
+    static size_t sample_size_;
+
+    // Largest expected number of points in a run; runs are built in memory
+    static size_t partition_points_;
+
+    // Seed of the sample
+    static unsigned int random_seed_;
+
+private:
+    // Top level node, split at a sampled point. Nodes without a split hold
+    // a run instead, numbered by partition.
+    struct SkeletonNode {
+        bool is_partition = false;
+        size_t partition = 0;
+        size_t split_axis = 0;
+        T split_position = T(0);
+        std::vector<T> point;       // Search-space coordinates of the pivot
+        size_t id = 0;              // Input file index of the pivot
+        size_t left = 0;
+        size_t right = 0;
+        size_t depth = 0;
+        size_t count = 0;           // Points in the subtree
+    };
+
+    // Run files created so far, removed when the build ends, also when it
+    // throws. Runs that were built are removed as soon as they are read.
+    struct RunFiles {
+        std::string prefix;
+        size_t count = 0;
+        ~RunFiles();
+    };
+
+    // Split a sample subset into the top levels, appending nodes in
+    // preorder. scale is the number of input points per sample point.
+    static size_t buildSkeleton(const std::vector<Point<T>*>& sample, const double& scale,
+                                const size_t depth, std::vector<SkeletonNode>& skeleton,
+                                size_t& partitions);
+
+    // Write the subtree of a skeleton node to its preorder position in the
+    // output file, and return its bounding box (empty without tight bounds)
+    static std::vector<T> writeSubtree(const std::vector<SkeletonNode>& skeleton,
+                                       const size_t& node, const uint32_t& position,
+                                       const size_t& dimension, const std::string& run_prefix,
+                                       const std::vector<uint64_t>& offsets,
+                                       std::ofstream& out_stream);
+
+public:
+    // Build a flat KD-tree file from a CSV input file without holding the
+    // input in memory. Runs are written to run_prefix.<n> and removed once
+    // built or when the build throws (default: output_file.run.<n>).
+    // Returns the number of points.
+    static size_t buildFromFile(const std::string& input_file,
+                                const std::string& output_file = "tree.kdx",
+                                const typename KdTree<T>::Metric_t& metric =
+                                    KdTree<T>::Metric_t::EUCLIDEAN,
+                                const std::string& run_prefix = "");
+};
+
+
+#include "kd_external.cpp"
+
+#endif /* KD_EXTERNAL_H_ */
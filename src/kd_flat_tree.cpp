@@ -0,0 +1,967 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_FLAT_TREE_CPP_
+#define KD_FLAT_TREE_CPP_
+
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+// The AVX2 packet kernels are compiled for x86 GCC and Clang builds
+// whatever the -m flags, and chosen at run time on CPUs that have AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KD_FLAT_TREE_AVX2
+#include <immintrin.h>
+#endif
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+
+using namespace std;
+
+// SET NUMBER OF INTERLEAVED QUERIES HERE
+template <typename T>
+size_t FlatKdTree<T>::query_group_size_ = 8;
+
+// SET PACKET TRAVERSAL OF QUERY BATCHES HERE
+template <typename T>
+bool FlatKdTree<T>::packet_queries_ = false;
+
+// SET ACTIVE LANE COUNT THAT ENDS PACKET TRAVERSAL HERE
+template <typename T>
+size_t FlatKdTree<T>::packet_scalar_lanes_ = 1;
+
+// SET AVX2 PACKET DISTANCES HERE
+template <typename T>
+bool FlatKdTree<T>::packet_simd_ = true;
+
+template <typename T>
+const size_t FlatKdTree<T>::packet_size_;
+
+template <typename T>
+const uint32_t FlatKdTree<T>::null_node_;
+
+namespace {
+
+// Identifies flat KD-tree files ("KDXFLAT2")
+const uint64_t flat_file_magic = 0x3254414c4658444bULL;
+
+// Sections of a flat KD-tree file start on this boundary
+const size_t flat_file_alignment = 64;
+
+// Queries of a PointSet are copied into Points this many at a time
+const size_t query_chunk_size = 4096;
+
+// Start of the section that follows one ending at offset
+inline uint64_t alignSection(const uint64_t& offset) {
+    return (offset + flat_file_alignment - 1) / flat_file_alignment * flat_file_alignment;
+}
+
+// Boundary the node section starts on: BFS blocks of a multiple of
+// flat_file_alignment bytes stay whole in the file
+template <typename T>
+size_t getNodeSectionAlignment(const uint64_t& layout, const uint64_t& block_bytes) {
+    bool block_aligned = layout == uint64_t(FlatKdTree<T>::Layout_t::BFS)
+                         && block_bytes > 0 && block_bytes % flat_file_alignment == 0;
+    return block_aligned ? size_t(block_bytes) : flat_file_alignment;
+}
+
+// Write a section padded up to the start of the next one, and return
+// whether the stream is still good
+template <typename V>
+bool writeSection(ofstream& out_stream, const vector<V>& section,
+                  const size_t& alignment = flat_file_alignment) {
+    if (!section.empty())
+        out_stream.write(reinterpret_cast<const char*>(section.data()), section.size()*sizeof(V));
+    size_t padding = (alignment - size_t(out_stream.tellp()) % alignment) % alignment;
+    vector<char> zeros(padding, 0);
+    out_stream.write(zeros.data(), padding);
+    return out_stream.good();
+}
+
+template <typename V>
+bool readSection(ifstream& in_stream, vector<V>& section, const size_t& count,
+                 const size_t& alignment = flat_file_alignment) {
+    section.resize(count);
+    if (count > 0)
+        in_stream.read(reinterpret_cast<char*>(section.data()), count*sizeof(V));
+    if (!in_stream.good())
+        return false;
+    size_t padding = (alignment - size_t(in_stream.tellg()) % alignment) % alignment;
+    in_stream.seekg(padding, ios::cur);
+    return in_stream.good();
+}
+
+// Squared distances from one Point to the 8 lanes of a query packet
+// (FlatKdTree::packet_size_)
+template <typename T>
+void packetDistances(const T* pt, const T* packet, const size_t& dimension, T* distances) {
+    for (size_t lane = 0; lane < 8; ++lane)
+        distances[lane] = T(0);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        for (size_t lane = 0; lane < 8; ++lane) {
+            T diff = pt[axis] - packet[axis*8 + lane];
+            distances[lane] += diff*diff;
+        }
+    }
+}
+
+#ifdef KD_FLAT_TREE_AVX2
+__attribute__((target("avx2")))
+void packetDistancesAvx2(const double* pt, const double* packet, const size_t& dimension,
+                         double* distances) {
+    __m256d low = _mm256_setzero_pd();
+    __m256d high = _mm256_setzero_pd();
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        __m256d coord = _mm256_broadcast_sd(pt + axis);
+        __m256d diff_low = _mm256_sub_pd(coord, _mm256_loadu_pd(packet + axis*8));
+        __m256d diff_high = _mm256_sub_pd(coord, _mm256_loadu_pd(packet + axis*8 + 4));
+        low = _mm256_add_pd(low, _mm256_mul_pd(diff_low, diff_low));
+        high = _mm256_add_pd(high, _mm256_mul_pd(diff_high, diff_high));
+    }
+    _mm256_storeu_pd(distances, low);
+    _mm256_storeu_pd(distances + 4, high);
+}
+
+__attribute__((target("avx2")))
+void packetDistancesAvx2(const float* pt, const float* packet, const size_t& dimension,
+                         float* distances) {
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        __m256 diff = _mm256_sub_ps(_mm256_broadcast_ss(pt + axis), _mm256_loadu_ps(packet + axis*8));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+    }
+    _mm256_storeu_ps(distances, sum);
+}
+
+// Whether this CPU runs AVX2, checked once
+bool hasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+#endif
+
+}
+
+template <typename T>
+bool FlatKdTree<T>::usesPacketSimd() {
+#ifdef KD_FLAT_TREE_AVX2
+    return packet_simd_ && hasAvx2();
+#else
+    return false;
+#endif
+}
+
+template <typename T>
+bool FlatKdNode<T>::isLeaf() const {
+    return (left_child == FlatKdTree<T>::null_node_ && right_child == FlatKdTree<T>::null_node_);
+}
+
+template <typename T>
+size_t FlatKdTree<T>::getNodeCount() const {
+    return nodes_.size();
+}
+
+template <typename T>
+double FlatKdTree<T>::getNodeBytesPerPoint() const {
+    if (nodes_.empty())
+        return 0.0;
+    return double(nodes_.size()*sizeof(FlatKdNode<T>) + bounds_.size()*sizeof(T))/ids_.size();
+}
+
+template <typename T>
+size_t FlatKdTree<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+typename FlatKdTree<T>::Layout_t FlatKdTree<T>::getLayout() const {
+    return layout_;
+}
+
+template <typename T>
+typename KdTree<T>::Metric_t FlatKdTree<T>::getMetric() const {
+    return metric_;
+}
+
+template <typename T>
+bool FlatKdTree<T>::isEmpty() const {
+    return nodes_.empty();
+}
+
+template <typename T>
+uint32_t FlatKdTree<T>::appendPreorder(const KdTreeNode<T>& node, vector<FlatKdNode<T>>& nodes,
+                                       vector<const KdTreeNode<T>*>& sources) {
+    uint32_t id = nodes.size();
+    FlatKdNode<T> flat_node;
+    flat_node.split_position = node.split_position;
+    flat_node.split_axis = node.split_axis;
+    flat_node.point = id;
+    flat_node.left_child = null_node_;
+    flat_node.right_child = null_node_;
+    nodes.push_back(flat_node);
+    sources.push_back(&node);
+
+    if (node.left_child != nullptr) {
+        uint32_t left = appendPreorder(*node.left_child, nodes, sources);
+        nodes[id].left_child = left;
+    }
+    if (node.right_child != nullptr) {
+        uint32_t right = appendPreorder(*node.right_child, nodes, sources);
+        nodes[id].right_child = right;
+    }
+    return id;
+}
+
+template <typename T>
+size_t FlatKdTree<T>::getHeight(const vector<FlatKdNode<T>>& nodes, const uint32_t& node) {
+    if (node == null_node_)
+        return 0;
+    return 1 + max(getHeight(nodes, nodes[node].left_child),
+                   getHeight(nodes, nodes[node].right_child));
+}
+
+template <typename T>
+void FlatKdTree<T>::bfsBlockOrder(const vector<FlatKdNode<T>>& nodes,
+                                  const size_t& block_bytes, vector<uint32_t>& order) {
+    const size_t node_bytes = sizeof(FlatKdNode<T>);
+    deque<uint32_t> block_roots(1, 0);
+    if (block_bytes < 2*node_bytes) {
+        // Blocks of at most one record group nothing: plain breadth-first order
+        while (!block_roots.empty()) {
+            const FlatKdNode<T>& node = nodes[block_roots.front()];
+            order.push_back(block_roots.front());
+            block_roots.pop_front();
+            if (node.left_child != null_node_)
+                block_roots.push_back(node.left_child);
+            if (node.right_child != null_node_)
+                block_roots.push_back(node.right_child);
+        }
+        return;
+    }
+
+    // Subtree sizes, from the leaves up; children follow their parent in preorder
+    vector<size_t> subtree_size(nodes.size(), 1);
+    for (size_t id = nodes.size(); id-- > 0; ) {
+        if (nodes[id].left_child != null_node_)
+            subtree_size[id] += subtree_size[nodes[id].left_child];
+        if (nodes[id].right_child != null_node_)
+            subtree_size[id] += subtree_size[nodes[id].right_child];
+    }
+
+    // Block k holds the records that fit between byte k*block_bytes and the
+    // next boundary. Each block root is filled breadth-first into the current
+    // block, and the children left over when it is full become later block
+    // roots. Subtrees that fit in the rest of a block share it; padding only
+    // moves a subtree that would not fit to the start of the next block.
+    size_t block = 0;
+    size_t block_start = 0;
+    size_t block_end = block_bytes/node_bytes;
+    while (!block_roots.empty()) {
+        uint32_t root = block_roots.front();
+        block_roots.pop_front();
+        if (order.size() >= block_end
+            || (order.size() > block_start && subtree_size[root] > block_end - order.size())) {
+            // Skip blocks too small to hold a whole record
+            do {
+                ++block;
+                block_start = (block*block_bytes + node_bytes - 1)/node_bytes;
+                block_end = (block+1)*block_bytes/node_bytes;
+            } while (block_end <= block_start);
+            while (order.size() < block_start)
+                order.push_back(null_node_);
+        }
+
+        deque<uint32_t> queue(1, root);
+        while (!queue.empty() && order.size() < block_end) {
+            const FlatKdNode<T>& node = nodes[queue.front()];
+            order.push_back(queue.front());
+            queue.pop_front();
+            if (node.left_child != null_node_)
+                queue.push_back(node.left_child);
+            if (node.right_child != null_node_)
+                queue.push_back(node.right_child);
+        }
+        block_roots.insert(block_roots.end(), queue.begin(), queue.end());
+    }
+}
+
+template <typename T>
+void FlatKdTree<T>::vebOrder(const vector<FlatKdNode<T>>& nodes, const uint32_t& node,
+                             const size_t& levels, vector<uint32_t>& order) {
+    if (node == null_node_ || levels == 0)
+        return;
+    if (levels == 1) {
+        order.push_back(node);
+        return;
+    }
+
+    // Lay out the top half of the levels, then each subtree hanging below it
+    size_t top_levels = levels/2;
+    vebOrder(nodes, node, top_levels, order);
+
+    vector<uint32_t> frontier(1, node);
+    for (size_t level = 0; level < top_levels; ++level) {
+        vector<uint32_t> next;
+        for (auto iter = frontier.begin(); iter != frontier.end(); ++iter) {
+            if (nodes[*iter].left_child != null_node_)
+                next.push_back(nodes[*iter].left_child);
+            if (nodes[*iter].right_child != null_node_)
+                next.push_back(nodes[*iter].right_child);
+        }
+        frontier.swap(next);
+    }
+    for (auto iter = frontier.begin(); iter != frontier.end(); ++iter) {
+        vebOrder(nodes, *iter, levels - top_levels, order);
+    }
+}
+
+template <typename T>
+FlatKdTree<T> FlatKdTree<T>::flatten(const KdTree<T>& source, const Layout_t& layout,
+                                     const size_t& block_bytes, const PointOrder_t& point_order) {
+    FlatKdTree<T> flat;
+    flat.metric_ = source.getMetric();
+    flat.max_norm_ = source.getMaxNorm();
+    flat.rotation_ = source.getRotation();
+    flat.layout_ = layout;
+    flat.block_bytes_ = block_bytes;
+
+    KdTree<T> tree = source;
+    if (!tree.isEmpty() && tree.getRootNode().deleted_count > 0)
+        tree.compact();
+    if (tree.isEmpty())
+        return flat;
+
+    KdTreeNode<T> root = tree.getRootNode();
+    flat.dimension_ = root.point.getDimension();
+    vector<FlatKdNode<T>> preorder;
+    vector<const KdTreeNode<T>*> sources;
+    preorder.reserve(root.size);
+    sources.reserve(root.size);
+    appendPreorder(root, preorder, sources);
+
+    vector<uint32_t> order;
+    order.reserve(preorder.size());
+    switch (layout) {
+    case Layout_t::BFS :
+        bfsBlockOrder(preorder, block_bytes, order);
+        break;
+
+    case Layout_t::VEB :
+        vebOrder(preorder, 0, getHeight(preorder, 0), order);
+        break;
+
+    case Layout_t::PREORDER :
+        for (uint32_t id = 0; id < preorder.size(); ++id) {
+            order.push_back(id);
+        }
+    }
+
+    vector<uint32_t> rank(preorder.size());
+    for (uint32_t position = 0; position < order.size(); ++position) {
+        if (order[position] != null_node_)
+            rank[order[position]] = position;
+    }
+
+    // Store nodes and their boxes in layout order
+    size_t dimension = flat.dimension_;
+    bool has_bounds = !root.bounds.empty();
+    flat.nodes_.reserve(order.size());
+    if (has_bounds)
+        flat.bounds_.reserve(order.size()*2*dimension);
+    vector<uint32_t> node_points;
+    node_points.reserve(sources.size());
+    for (auto iter = order.begin(); iter != order.end(); ++iter) {
+        if (*iter == null_node_) {
+            // Padding record, unreachable from the root
+            FlatKdNode<T> padding = {T(0), 0, null_node_, null_node_, null_node_};
+            flat.nodes_.push_back(padding);
+            if (has_bounds) {
+                flat.bounds_.insert(flat.bounds_.end(), dimension, numeric_limits<T>::max());
+                flat.bounds_.insert(flat.bounds_.end(), dimension, numeric_limits<T>::lowest());
+            }
+            continue;
+        }
+
+        FlatKdNode<T> node = preorder[*iter];
+        node.point = (point_order == PointOrder_t::NODE) ? node_points.size() : *iter;
+        node_points.push_back(*iter);
+        if (node.left_child != null_node_)
+            node.left_child = rank[node.left_child];
+        if (node.right_child != null_node_)
+            node.right_child = rank[node.right_child];
+        flat.nodes_.push_back(node);
+
+        const KdTreeNode<T>& source_node = *sources[*iter];
+        if (has_bounds && !source_node.bounds.empty()) {
+            flat.bounds_.insert(flat.bounds_.end(), source_node.bounds.begin(),
+                                source_node.bounds.end());
+        }
+        else if (has_bounds) {
+            flat.bounds_.insert(flat.bounds_.end(), dimension, numeric_limits<T>::lowest());
+            flat.bounds_.insert(flat.bounds_.end(), dimension, numeric_limits<T>::max());
+        }
+    }
+
+    // Store Points in the requested order, with their input file indexes
+    flat.coords_.reserve(sources.size()*dimension);
+    flat.ids_.reserve(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        const Point<T>& point = (point_order == PointOrder_t::NODE) ? sources[node_points[i]]->point
+                                                                     : sources[i]->point;
+        flat.coords_.insert(flat.coords_.end(), point.begin(), point.end());
+        flat.ids_.push_back(point.getIndex());
+    }
+    return flat;
+}
+
+template <typename T>
+vector<T> FlatKdTree<T>::toSearchQuery(const Point<T>& query) const {
+    if (metric_ == KdTree<T>::Metric_t::EUCLIDEAN && rotation_.empty())
+        return query.getPointVector();
+    Point<T> rotated = rotation_.empty() ? query : rotatePoint(rotation_, query);
+    return KdTree<T>::transformPoint(rotated, metric_, max_norm_, true).getPointVector();
+}
+
+template <typename T>
+void FlatKdTree<T>::getNearestNeighbor(const uint32_t& node, const T* query,
+                                       uint32_t& best_point, T& best_dist) const {
+    const FlatKdNode<T>& flat_node = nodes_[node];
+    if (!bounds_.empty()) {
+        const T* box = &bounds_[size_t(node)*2*dimension_];
+        T box_dist = T(0);
+        for (size_t axis = 0; axis < dimension_; ++axis) {
+            T excess = max(box[axis] - query[axis], max(query[axis] - box[dimension_+axis], T(0)));
+            box_dist += excess*excess;
+        }
+        if (box_dist >= best_dist)
+            return;
+    }
+
+    const T* pt = &coords_[size_t(flat_node.point)*dimension_];
+    T distance = T(0);
+    for (size_t axis = 0; axis < dimension_; ++axis) {
+        T diff = pt[axis] - query[axis];
+        distance += diff*diff;
+    }
+    if (distance < best_dist) {
+        best_dist = distance;
+        best_point = flat_node.point;
+    }
+    if (flat_node.isLeaf())
+        return;
+
+    T plane_dist = query[flat_node.split_axis] - flat_node.split_position;
+    uint32_t near_child = (plane_dist < T(0)) ? flat_node.left_child : flat_node.right_child;
+    uint32_t far_child = (plane_dist < T(0)) ? flat_node.right_child : flat_node.left_child;
+    if (near_child != null_node_)
+        getNearestNeighbor(near_child, query, best_point, best_dist);
+    if (far_child != null_node_ && plane_dist*plane_dist < best_dist)
+        getNearestNeighbor(far_child, query, best_point, best_dist);
+}
+
+template <typename T>
+pair<size_t, T> FlatKdTree<T>::findNearest(const Point<T>& query) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    vector<T> search_query = toSearchQuery(query);
+    uint32_t best_point = 0;
+    T best_dist = numeric_limits<T>::max();
+    getNearestNeighbor(0, search_query.data(), best_point, best_dist);
+    return make_pair(ids_[best_point],
+                     KdTree<T>::transformScore(sqrt(best_dist), query, metric_, max_norm_));
+}
+
+template <typename T>
+pair<size_t, T> FlatKdTree<T>::findNearest(const Point<T>& query, uint32_t& hint,
+                                          const T& upper_bound) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    vector<T> search_query = toSearchQuery(query);
+    uint32_t best_point = null_node_;
+    T best_dist = (upper_bound < sqrt(numeric_limits<T>::max())) ? upper_bound*upper_bound
+                                                                : numeric_limits<T>::max();
+
+    // Path from the root towards the hinted Point
+    vector<uint32_t> path;
+    if (hint < ids_.size()) {
+        const T* hint_pt = &coords_[size_t(hint)*dimension_];
+        uint32_t node = 0;
+        while (node != null_node_) {
+            path.push_back(node);
+            const FlatKdNode<T>& flat_node = nodes_[node];
+            if (flat_node.point == hint)
+                break;
+            node = (hint_pt[flat_node.split_axis] < flat_node.split_position) ? flat_node.left_child
+                                                                             : flat_node.right_child;
+        }
+    }
+
+    const T* query_pt = search_query.data();
+    if (path.empty()) {
+        getNearestNeighbor(0, query_pt, best_point, best_dist);
+    }
+    else {
+        getNearestNeighbor(path.back(), query_pt, best_point, best_dist);
+        for (size_t level = path.size()-1; level-- > 0;) {
+            const FlatKdNode<T>& flat_node = nodes_[path[level]];
+            const T* pt = &coords_[size_t(flat_node.point)*dimension_];
+            T distance = T(0);
+            for (size_t axis = 0; axis < dimension_; ++axis) {
+                T diff = pt[axis] - query_pt[axis];
+                distance += diff*diff;
+            }
+            if (distance < best_dist) {
+                best_dist = distance;
+                best_point = flat_node.point;
+            }
+            bool from_left = (flat_node.left_child == path[level+1]);
+            uint32_t sibling = from_left ? flat_node.right_child : flat_node.left_child;
+            T plane_dist = query_pt[flat_node.split_axis] - flat_node.split_position;
+            bool sibling_near = from_left ? (plane_dist >= T(0)) : (plane_dist < T(0));
+            if (sibling != null_node_ && (sibling_near || plane_dist*plane_dist < best_dist))
+                getNearestNeighbor(sibling, query_pt, best_point, best_dist);
+        }
+    }
+
+    if (best_point == null_node_)
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+    hint = best_point;
+    return make_pair(ids_[best_point],
+                     KdTree<T>::transformScore(sqrt(best_dist), query, metric_, max_norm_));
+}
+
+template <typename T>
+void FlatKdTree<T>::prefetchNode(const uint32_t& node) const {
+#if defined(__GNUC__)
+    __builtin_prefetch(&nodes_[node]);
+#endif
+}
+
+template <typename T>
+void FlatKdTree<T>::prefetchNodeData(const uint32_t& node) const {
+#if defined(__GNUC__)
+    const T* pt = &coords_[size_t(nodes_[node].point)*dimension_];
+    __builtin_prefetch(pt);
+    __builtin_prefetch(pt + dimension_ - 1);
+    if (!bounds_.empty()) {
+        const T* box = &bounds_[size_t(node)*2*dimension_];
+        __builtin_prefetch(box);
+        __builtin_prefetch(box + 2*dimension_ - 1);
+    }
+#endif
+}
+
+template <typename T>
+vector<pair<size_t, T>> FlatKdTree<T>::findNearestBatch(const vector<Point<T>*>& queries,
+                                                       const size_t& group_size) const {
+    vector<pair<size_t, T>> results(queries.size(),
+        make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max()));
+    if (isEmpty() || queries.empty())
+        return results;
+
+    // One in-flight traversal, moving a node through three steps: POP
+    // takes the next unpruned node and prefetches its record, LOAD reads
+    // the record and prefetches its Point and box, VISIT searches the node,
+    // pushes its children and prefetches the record of the near child.
+    // A near child popped right after its parent is loaded within POP, as
+    // its record is already on the way. Between steps the traversal
+    // yields, so the other queries work while the lines load.
+    enum class Step_t {POP, LOAD, VISIT};
+    struct Traversal {
+        size_t query_id;
+        vector<T> query;
+        vector<pair<uint32_t, T>> stack;    // {node, squared plane distance}
+        uint32_t node;
+        uint32_t prefetched;                // Record prefetched by the last VISIT
+        Step_t step;
+        uint32_t best_point;
+        T best_dist;
+    };
+
+    size_t slots = max(group_size, size_t(1));
+    vector<Traversal> group(min(slots, queries.size()));
+    size_t next_query = 0;
+    auto start = [&](Traversal& traversal) {
+        const Point<T>& query = *queries[next_query];
+        traversal.query_id = next_query++;
+        traversal.query = toSearchQuery(query);
+        traversal.stack.assign(1, make_pair(uint32_t(0), T(0)));
+        traversal.prefetched = null_node_;
+        traversal.step = Step_t::POP;
+        traversal.best_point = 0;
+        traversal.best_dist = numeric_limits<T>::max();
+    };
+    for (auto iter = group.begin(); iter != group.end(); ++iter)
+        start(*iter);
+
+    size_t active = group.size();
+    while (active > 0) {
+        for (auto iter = group.begin(); iter != group.end(); ++iter) {
+            Traversal& traversal = *iter;
+            if (traversal.stack.empty() && traversal.step == Step_t::POP)
+                continue;
+
+            if (traversal.step == Step_t::POP) {
+                while (!traversal.stack.empty() && traversal.step == Step_t::POP) {
+                    pair<uint32_t, T> entry = traversal.stack.back();
+                    traversal.stack.pop_back();
+                    if (entry.second < traversal.best_dist) {
+                        traversal.node = entry.first;
+                        traversal.step = Step_t::LOAD;
+                        if (entry.first != traversal.prefetched)
+                            prefetchNode(entry.first);
+                    }
+                }
+                if (traversal.step == Step_t::LOAD && traversal.node == traversal.prefetched) {
+                    traversal.step = Step_t::VISIT;
+                    prefetchNodeData(traversal.node);
+                }
+                traversal.prefetched = null_node_;
+            }
+            else if (traversal.step == Step_t::LOAD) {
+                traversal.step = Step_t::VISIT;
+                prefetchNodeData(traversal.node);
+            }
+            else {
+                traversal.step = Step_t::POP;
+                const FlatKdNode<T>& flat_node = nodes_[traversal.node];
+                const T* query = traversal.query.data();
+                bool pruned = false;
+                if (!bounds_.empty()) {
+                    const T* box = &bounds_[size_t(traversal.node)*2*dimension_];
+                    T box_dist = T(0);
+                    for (size_t axis = 0; axis < dimension_; ++axis) {
+                        T excess = max(box[axis] - query[axis],
+                                       max(query[axis] - box[dimension_+axis], T(0)));
+                        box_dist += excess*excess;
+                    }
+                    pruned = box_dist >= traversal.best_dist;
+                }
+                if (!pruned) {
+                    const T* pt = &coords_[size_t(flat_node.point)*dimension_];
+                    T distance = T(0);
+                    for (size_t axis = 0; axis < dimension_; ++axis) {
+                        T diff = pt[axis] - query[axis];
+                        distance += diff*diff;
+                    }
+                    if (distance < traversal.best_dist) {
+                        traversal.best_dist = distance;
+                        traversal.best_point = flat_node.point;
+                    }
+                    if (!flat_node.isLeaf()) {
+                        T plane_dist = query[flat_node.split_axis] - flat_node.split_position;
+                        uint32_t near_child = (plane_dist < T(0)) ? flat_node.left_child
+                                                                  : flat_node.right_child;
+                        uint32_t far_child = (plane_dist < T(0)) ? flat_node.right_child
+                                                                 : flat_node.left_child;
+                        if (far_child != null_node_)
+                            traversal.stack.push_back(make_pair(far_child, plane_dist*plane_dist));
+                        if (near_child != null_node_) {
+                            traversal.stack.push_back(make_pair(near_child, T(0)));
+                            traversal.prefetched = near_child;
+                            prefetchNode(near_child);
+                        }
+                    }
+                }
+            }
+
+            if (traversal.stack.empty() && traversal.step == Step_t::POP) {
+                const Point<T>& query = *queries[traversal.query_id];
+                results[traversal.query_id] = make_pair(ids_[traversal.best_point],
+                    KdTree<T>::transformScore(sqrt(traversal.best_dist), query, metric_, max_norm_));
+                if (next_query < queries.size())
+                    start(traversal);
+                else
+                    --active;
+            }
+        }
+    }
+    return results;
+}
+
+template <typename T>
+void FlatKdTree<T>::getPacketNearestNeighbors(const T* packet, const vector<T>& lane_queries,
+                                              const uint32_t& lane_mask, uint32_t* best_points,
+                                              T* best_dists) const {
+    // Stack entries are {node, parent, lanes}. A lane's lower bound for a
+    // node is its plane distance at the parent when the node is on the far side.
+    struct Entry {
+        uint32_t node;
+        uint32_t parent;
+        uint32_t lanes;
+    };
+    vector<Entry> stack(1, Entry{0, null_node_, lane_mask});
+    T distances[packet_size_];
+    bool simd = usesPacketSimd();
+
+    while (!stack.empty()) {
+        Entry entry = stack.back();
+        stack.pop_back();
+        uint32_t lanes = entry.lanes;
+        if (entry.parent != null_node_) {
+            const FlatKdNode<T>& parent = nodes_[entry.parent];
+            const T* coords = &packet[parent.split_axis*packet_size_];
+            bool is_right = (entry.node == parent.right_child);
+            uint32_t kept = 0;
+            for (size_t lane = 0; lane < packet_size_; ++lane) {
+                T plane_dist = coords[lane] - parent.split_position;
+                bool is_near = is_right ? (plane_dist >= T(0)) : (plane_dist < T(0));
+                kept |= uint32_t(is_near || plane_dist*plane_dist < best_dists[lane]) << lane;
+            }
+            lanes &= kept;
+        }
+        if (!bounds_.empty() && lanes != 0) {
+            const T* box = &bounds_[size_t(entry.node)*2*dimension_];
+            for (size_t lane = 0; lane < packet_size_; ++lane) {
+                if (!(lanes & (1u << lane)))
+                    continue;
+                T box_dist = T(0);
+                for (size_t axis = 0; axis < dimension_; ++axis) {
+                    T coord = packet[axis*packet_size_ + lane];
+                    T excess = max(box[axis] - coord, max(coord - box[dimension_+axis], T(0)));
+                    box_dist += excess*excess;
+                }
+                if (box_dist >= best_dists[lane])
+                    lanes &= ~(1u << lane);
+            }
+        }
+
+        // Too few lanes left to share the work, finish them one at a time
+        size_t active = 0;
+        for (size_t lane = 0; lane < packet_size_; ++lane)
+            active += (lanes >> lane) & 1u;
+        if (active == 0)
+            continue;
+        if (active <= packet_scalar_lanes_) {
+            for (size_t lane = 0; lane < packet_size_; ++lane) {
+                if (lanes & (1u << lane))
+                    getNearestNeighbor(entry.node, &lane_queries[lane*dimension_],
+                                       best_points[lane], best_dists[lane]);
+            }
+            continue;
+        }
+
+        const FlatKdNode<T>& flat_node = nodes_[entry.node];
+        const T* pt = &coords_[size_t(flat_node.point)*dimension_];
+#ifdef KD_FLAT_TREE_AVX2
+        if (simd)
+            packetDistancesAvx2(pt, packet, dimension_, distances);
+        else
+#endif
+            packetDistances(pt, packet, dimension_, distances);
+        for (size_t lane = 0; lane < packet_size_; ++lane) {
+            if ((lanes & (1u << lane)) && distances[lane] < best_dists[lane]) {
+                best_dists[lane] = distances[lane];
+                best_points[lane] = flat_node.point;
+            }
+        }
+        if (flat_node.isLeaf())
+            continue;
+
+        // Lanes that disagree on the near child split into two packets,
+        // each visiting its own near child first
+        const T* coords = &packet[flat_node.split_axis*packet_size_];
+        uint32_t left_lanes = 0;
+        for (size_t lane = 0; lane < packet_size_; ++lane)
+            left_lanes |= uint32_t(coords[lane] < flat_node.split_position) << lane;
+        left_lanes &= lanes;
+        uint32_t right_lanes = lanes & ~left_lanes;
+        if (right_lanes != 0) {
+            if (flat_node.left_child != null_node_)
+                stack.push_back(Entry{flat_node.left_child, entry.node, right_lanes});
+            if (flat_node.right_child != null_node_)
+                stack.push_back(Entry{flat_node.right_child, entry.node, right_lanes});
+        }
+        if (left_lanes != 0) {
+            if (flat_node.right_child != null_node_)
+                stack.push_back(Entry{flat_node.right_child, entry.node, left_lanes});
+            if (flat_node.left_child != null_node_)
+                stack.push_back(Entry{flat_node.left_child, entry.node, left_lanes});
+        }
+    }
+}
+
+template <typename T>
+vector<pair<size_t, T>> FlatKdTree<T>::findNearestPacket(const vector<Point<T>*>& queries) const {
+    static_assert(packet_size_ == 8, "packetDistances() computes 8 lanes");
+    vector<pair<size_t, T>> results(queries.size(),
+        make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max()));
+    if (isEmpty())
+        return results;
+
+    vector<T> packet(dimension_*packet_size_);
+    vector<T> lane_queries(dimension_*packet_size_);
+    uint32_t best_points[packet_size_];
+    T best_dists[packet_size_];
+    for (size_t first = 0; first < queries.size(); first += packet_size_) {
+        size_t lanes = min(packet_size_, queries.size() - first);
+        for (size_t lane = 0; lane < packet_size_; ++lane) {
+            // Unused lanes repeat the last query and stay masked off
+            const Point<T>& query = *queries[first + min(lane, lanes-1)];
+            vector<T> search_query = toSearchQuery(query);
+            for (size_t axis = 0; axis < dimension_; ++axis) {
+                packet[axis*packet_size_ + lane] = search_query[axis];
+                lane_queries[lane*dimension_ + axis] = search_query[axis];
+            }
+            best_points[lane] = 0;
+            best_dists[lane] = numeric_limits<T>::max();
+        }
+
+        getPacketNearestNeighbors(packet.data(), lane_queries, (1u << lanes) - 1,
+                                  best_points, best_dists);
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            const Point<T>& query = *queries[first + lane];
+            results[first + lane] = make_pair(ids_[best_points[lane]],
+                KdTree<T>::transformScore(sqrt(best_dists[lane]), query, metric_, max_norm_));
+        }
+    }
+    return results;
+}
+
+template <typename T>
+void FlatKdTree<T>::queryFlatKdTree(const FlatKdTree<T>& tree,
+                                    const vector<Point<T>*>& query_points) {
+    vector<size_t> order;
+    vector<Point<T>*> ordered_points;
+    if (KdTree<T>::morton_query_order_) {
+        order = getMortonOrder(query_points);
+        ordered_points.reserve(query_points.size());
+        for (auto iter = order.begin(); iter != order.end(); ++iter) {
+            ordered_points.push_back(query_points[*iter]);
+        }
+    }
+    else {
+        order.resize(query_points.size());
+        iota(order.begin(), order.end(), size_t(0));
+        ordered_points = query_points;
+    }
+
+    vector<pair<size_t, T>> nearest = packet_queries_ ? tree.findNearestPacket(ordered_points)
+        : tree.findNearestBatch(ordered_points, query_group_size_);
+    vector<size_t> pointId(query_points.size());
+    vector<T> dist(query_points.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        pointId[order[i]] = nearest[i].first;
+        dist[order[i]] = nearest[i].second;
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+void FlatKdTree<T>::queryFlatKdTree(const FlatKdTree<T>& tree,
+                                    const PointSet<T>& query_points) {
+    vector<size_t> order;
+    if (KdTree<T>::morton_query_order_) {
+        order = getMortonOrder(query_points.data(), query_points.size(), query_points.getDimension());
+    }
+    else {
+        order.resize(query_points.size());
+        iota(order.begin(), order.end(), size_t(0));
+    }
+
+    // Batches and packets take Points, which are made from the set's buffer
+    // one chunk of queries at a time
+    vector<size_t> pointId(query_points.size());
+    vector<T> dist(query_points.size());
+    vector<Point<T>> chunk;
+    vector<Point<T>*> chunk_ptrs;
+    for (size_t first = 0; first < order.size(); first += query_chunk_size) {
+        size_t last = min(first + query_chunk_size, order.size());
+        chunk.clear();
+        chunk_ptrs.clear();
+        for (size_t i = first; i < last; ++i) {
+            chunk.push_back(query_points[order[i]].toPoint());
+        }
+        for (auto iter = chunk.begin(); iter != chunk.end(); ++iter) {
+            chunk_ptrs.push_back(&(*iter));
+        }
+        vector<pair<size_t, T>> nearest = packet_queries_ ? tree.findNearestPacket(chunk_ptrs)
+            : tree.findNearestBatch(chunk_ptrs, query_group_size_);
+        for (size_t i = first; i < last; ++i) {
+            pointId[order[i]] = nearest[i - first].first;
+            dist[order[i]] = nearest[i - first].second;
+        }
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+void FlatKdTree<T>::WriteFlatKdTreeToFile(const FlatKdTree<T>& tree, const string& file) {
+    ofstream out_stream(file, ios::binary);
+    vector<uint64_t> header = {flat_file_magic, sizeof(T), tree.dimension_, tree.nodes_.size(),
+                               tree.ids_.size(), tree.bounds_.size(),
+                               uint64_t(tree.metric_), uint64_t(tree.layout_), tree.block_bytes_,
+                               tree.rotation_.size()};
+    vector<T> max_norm(1, tree.max_norm_);
+    size_t node_alignment = getNodeSectionAlignment<T>(header[7], header[8]);
+    if (!writeSection(out_stream, header) || !writeSection(out_stream, max_norm)
+        || !writeSection(out_stream, tree.rotation_, node_alignment)
+        || !writeSection(out_stream, tree.nodes_) || !writeSection(out_stream, tree.coords_)
+        || !writeSection(out_stream, tree.ids_) || !writeSection(out_stream, tree.bounds_))
+        throw runtime_error("Cannot write flat KD-tree file: " + file);
+    out_stream.close();
+    if (out_stream.fail())
+        throw runtime_error("Cannot write flat KD-tree file: " + file);
+}
+
+template <typename T>
+void FlatKdTree<T>::ReadFlatKdTreeFromFile(FlatKdTree<T>& tree, const string& file) {
+    ifstream in_stream(file, ios::binary);
+    vector<uint64_t> header;
+    if (!readSection(in_stream, header, 10) || header[0] != flat_file_magic
+        || header[1] != sizeof(T))
+        throw runtime_error("Not a flat KD-tree file of this precision: " + file);
+
+    vector<T> max_norm;
+    if (!readSection(in_stream, max_norm, 1)
+        || !readSection(in_stream, tree.rotation_, header[9],
+                        getNodeSectionAlignment<T>(header[7], header[8]))
+        || !readSection(in_stream, tree.nodes_, header[3])
+        || !readSection(in_stream, tree.coords_, header[4]*header[2])
+        || !readSection(in_stream, tree.ids_, header[4])
+        || !readSection(in_stream, tree.bounds_, header[5]))
+        throw runtime_error("Truncated flat KD-tree file: " + file);
+    tree.dimension_ = header[2];
+    tree.metric_ = typename KdTree<T>::Metric_t(header[6]);
+    tree.layout_ = Layout_t(header[7]);
+    tree.block_bytes_ = header[8];
+    tree.max_norm_ = max_norm[0];
+}
+
+template struct FlatKdNode<float>;
+template class FlatKdTree<float>;
+template struct FlatKdNode<double>;
+template class FlatKdTree<double>;
+
+
+#endif /* KD_FLAT_TREE_CPP_ */
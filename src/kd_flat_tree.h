@@ -0,0 +1,204 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_FLAT_TREE_H_
+#define KD_FLAT_TREE_H_
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <limits>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+
+// Node of a flattened KD-tree. Children and points are offsets into the
+// arrays of the owning FlatKdTree.
+template <typename T=double>
+struct FlatKdNode {
+    T split_position;
+    uint32_t split_axis;
+    uint32_t point;             // Offset of the node's Point
+    uint32_t left_child;
+    uint32_t right_child;
+
+    bool isLeaf() const;
+};
+
+// Static, read-only KD-tree stored in a few contiguous arrays. A built
+// KdTree is renumbered into a cache-friendly node order, so that the top
+// levels share cache lines and every cache miss or page fault fetches a
+// whole block of a subtree.
+template <typename T=double>
+class FlatKdTree {
+public:
+    // PREORDER keeps depth-first order. BFS groups nodes into blocks of
+    // block_bytes, each holding the top levels of a subtree in breadth-first
+    // order, and packs small subtrees together into one block. A subtree
+    // that would cross a block_bytes boundary of the node array starts the
+    // next block instead, behind unused padding records, and files start the
+    // node array on such a boundary (block_bytes a multiple of 64). VEB uses
+    // the recursive van Emde Boas order, which is cache-oblivious and
+    // ignores block_bytes.
+    enum class Layout_t {PREORDER, BFS, VEB};
+
+    // SUBTREE stores Points in depth-first order, so the Points of any
+    // subtree form one contiguous range. NODE stores Points in the order of
+    // their nodes, so the Points of a node block are contiguous too.
+    enum class PointOrder_t {SUBTREE, NODE};
+
+    static const uint32_t null_node_ = 0xFFFFFFFF;
+
+    // Number of queries whose traversals queryFlatKdTree interleaves.
+    // 1 runs each query on its own.
+    static size_t query_group_size_;
+
+    // Run queryFlatKdTree with packet traversal. Suits batches whose
+    // consecutive queries are close to each other.
+    static bool packet_queries_;
+
+    // Lanes of a query packet, and the active lane count at or below which
+    // the remaining lanes leave the packet and finish one by one
+    static const size_t packet_size_ = 8;
+    static size_t packet_scalar_lanes_;
+
+    // Compute the distances of a packet with AVX2 on CPUs that have it.
+    // The kernels are built into x86 GCC and Clang builds without -mavx2
+    // and chosen at run time; usesPacketSimd() tells whether they run.
+    static bool packet_simd_;
+    static bool usesPacketSimd();
+
+private:
+    size_t dimension_ = 0;
+    std::vector<FlatKdNode<T>> nodes_;      // nodes_[0] is the root
+    std::vector<T> coords_;                 // Row-major Point coordinates
+    std::vector<size_t> ids_;               // Input file index of each stored Point
+    std::vector<T> bounds_;                 // Optional {min..., max...} per node
+    typename KdTree<T>::Metric_t metric_ = KdTree<T>::Metric_t::EUCLIDEAN;
+    T max_norm_ = T(0);
+    std::vector<T> rotation_;               // PCA rotation of the source tree, if any
+    Layout_t layout_ = Layout_t::PREORDER;
+    size_t block_bytes_ = 0;
+
+    // Indexes that reuse the node structure with other Point storage
+    template <typename U, typename Q> friend class QuantizedKdTree;
+
+    // Writes flat KD-tree files built out of core
+    template <typename U> friend class ExternalKdTreeBuilder;
+
+    // Copy a pointer-based subtree into preorder, returning its root id
+    static uint32_t appendPreorder(const KdTreeNode<T>& node, std::vector<FlatKdNode<T>>& nodes,
+                                   std::vector<const KdTreeNode<T>*>& sources);
+
+    // Node orders, as lists of preorder ids
+    // (null_node_ marks a padding record)
+    static void bfsBlockOrder(const std::vector<FlatKdNode<T>>& nodes,
+                              const size_t& block_bytes, std::vector<uint32_t>& order);
+    static void vebOrder(const std::vector<FlatKdNode<T>>& nodes, const uint32_t& node,
+                         const size_t& levels, std::vector<uint32_t>& order);
+    static size_t getHeight(const std::vector<FlatKdNode<T>>& nodes, const uint32_t& node);
+
+    // Map a query into the space the nodes and Points are stored in
+    std::vector<T> toSearchQuery(const Point<T>& query) const;
+
+    // Recursively find nearest neighbor. Distances are squared.
+    void getNearestNeighbor(const uint32_t& node, const T* query,
+                            uint32_t& best_point, T& best_dist) const;
+
+    // Prefetch a node record, or the Point and box of a node.
+    // prefetchNodeData reads the record, which should be prefetched first.
+    void prefetchNode(const uint32_t& node) const;
+    void prefetchNodeData(const uint32_t& node) const;
+
+    // Traverse the tree with one packet of queries stored lane-interleaved
+    // (query[axis*packet_size_ + lane]). Distances are squared.
+    void getPacketNearestNeighbors(const T* packet, const std::vector<T>& lane_queries,
+                                   const uint32_t& lane_mask, uint32_t* best_points,
+                                   T* best_dists) const;
+
+public:
+    // Constructors/Destructor
+    FlatKdTree() = default;
+    ~FlatKdTree() = default;
+
+    // Flatten a built KD-tree into the given layout. Erased points are
+    // dropped first.
+    static FlatKdTree<T> flatten(const KdTree<T>& tree, const Layout_t& layout = Layout_t::VEB,
+                                 const size_t& block_bytes = 4096,
+                                 const PointOrder_t& point_order = PointOrder_t::SUBTREE);
+
+    // Member functions
+    size_t getNodeCount() const;
+    size_t getDimension() const;
+    Layout_t getLayout() const;
+    typename KdTree<T>::Metric_t getMetric() const;
+    bool isEmpty() const;
+
+    // Bytes per Point taken by the node records and their bounding boxes
+    double getNodeBytesPerPoint() const;
+
+    // Find the nearest neighbor of a single query under the tree's metric.
+    // Returns {point index, score}.
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Warm-started search for streams of nearby queries. hint is the
+    // offset of a stored Point, e.g. the previous result, and is replaced
+    // by the offset of this result; null_node_ searches from the root.
+    // The search descends to the hinted Point, searches its subtree first
+    // and walks back up, visiting other subtrees only where they can beat
+    // the bound found so far. upper_bound seeds the bound, as a distance
+    // in the tree's search space. Returns {max, max} when no Point lies
+    // within upper_bound.
+    std::pair<size_t, T> findNearest(const Point<T>& query, uint32_t& hint,
+                                     const T& upper_bound = std::numeric_limits<T>::max()) const;
+
+    // Find the nearest neighbors of a batch of queries, interleaving up to
+    // group_size traversals. Each traversal keeps an explicit stack and
+    // prefetches the nodes and Points it needs next, then yields to the
+    // others while they load. Results are identical to findNearest().
+    std::vector<std::pair<size_t, T>> findNearestBatch(const std::vector<Point<T>*>& queries,
+                                                       const size_t& group_size = 8) const;
+
+    // Find the nearest neighbors of a batch of queries in packets of
+    // packet_size_ consecutive queries. A packet computes distances and
+    // plane tests for all its lanes together, drops lanes that are pruned
+    // and splits where lanes disagree on the near child. Results are
+    // identical to findNearest().
+    std::vector<std::pair<size_t, T>> findNearestPacket(const std::vector<Point<T>*>& queries) const;
+
+    // Query flat KD tree for a set of points
+    static void queryFlatKdTree(const FlatKdTree<T>& tree,
+                                const std::vector<Point<T>*>& query_points);
+    static void queryFlatKdTree(const FlatKdTree<T>& tree, const PointSet<T>& query_points);
+
+    // Read/Write flat KD-tree to a raw binary file that can be mapped as is:
+    // header, then the rotation, node, coordinate, index and bounds arrays
+    static void WriteFlatKdTreeToFile(const FlatKdTree<T>& tree, const std::string& file="tree.kdx");
+    static void ReadFlatKdTreeFromFile(FlatKdTree<T>& tree, const std::string& file="tree.kdx");
+};
+
+
+#include "kd_flat_tree.cpp"
+
+#endif /* KD_FLAT_TREE_H_ */
@@ -0,0 +1,343 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_FOREST_CPP_
+#define KD_FOREST_CPP_
+
+#include <vector>
+#include <queue>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <thread>
+#include <cmath>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_forest.h"
+
+using namespace std;
+
+// SET NUMBER OF HIGHEST-VARIANCE SPLIT AXIS CANDIDATES HERE
+template <typename T>
+size_t KdForest<T>::top_variance_axes_ = 5;
+
+// SET RANDOM SEED OF THE FOREST HERE
+template <typename T>
+unsigned int KdForest<T>::random_seed_ = 1;
+
+namespace {
+
+// Split axis variances are estimated from at most this many Points
+const size_t variance_sample_size = 100;
+
+}
+
+template <typename T>
+uint32_t KdForest<T>::buildTree(vector<uint32_t>& order, const size_t& begin, const size_t& end,
+                                const vector<T>& coords, const size_t& dimension,
+                                mt19937& rng, vector<FlatKdNode<T>>& nodes) {
+    if (begin == end)
+        return FlatKdTree<T>::null_node_;
+
+    // Variance of every axis over an evenly spaced sample of the subset
+    size_t count = end - begin;
+    size_t stride = max(count/variance_sample_size, size_t(1));
+    vector<double> mean(dimension, 0.0);
+    vector<double> variance(dimension, 0.0);
+    size_t sampled = 0;
+    for (size_t i = begin; i < end; i += stride, ++sampled) {
+        const T* pt = &coords[size_t(order[i])*dimension];
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            double delta = pt[axis] - mean[axis];
+            mean[axis] += delta/(sampled+1);
+            variance[axis] += delta*(pt[axis] - mean[axis]);
+        }
+    }
+
+    // Random axis among the ones of highest variance
+    vector<size_t> axes(dimension);
+    iota(axes.begin(), axes.end(), size_t(0));
+    size_t candidates = min(max(top_variance_axes_, size_t(1)), dimension);
+    partial_sort(axes.begin(), axes.begin() + candidates, axes.end(),
+                 [&variance](const size_t& a, const size_t& b) { return variance[a] > variance[b]; });
+    size_t split_axis = axes[uniform_int_distribution<size_t>(0, candidates-1)(rng)];
+
+    // Median Point is the node's pivot. Points left of it are <= the split
+    // position and Points right of it are >=.
+    size_t middle = begin + count/2;
+    nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                [&coords, &dimension, &split_axis](const uint32_t& a, const uint32_t& b) {
+                    return coords[size_t(a)*dimension + split_axis]
+                           < coords[size_t(b)*dimension + split_axis];
+                });
+
+    uint32_t id = nodes.size();
+    FlatKdNode<T> node;
+    node.point = order[middle];
+    node.split_axis = split_axis;
+    node.split_position = coords[size_t(order[middle])*dimension + split_axis];
+    nodes.push_back(node);
+    uint32_t left_child = buildTree(order, begin, middle, coords, dimension, rng, nodes);
+    uint32_t right_child = buildTree(order, middle+1, end, coords, dimension, rng, nodes);
+    nodes[id].left_child = left_child;
+    nodes[id].right_child = right_child;
+    return id;
+}
+
+template <typename T>
+void KdForest<T>::buildTree(const size_t& tree) {
+    ForestTree& forest_tree = trees_[tree];
+    mt19937 rng(random_seed_ + tree);
+    vector<T> rotated;
+    if (!forest_tree.rotation.empty()) {
+        rotated.resize(coords_.size());
+        for (size_t i = 0; i < ids_.size(); ++i) {
+            const T* pt = &coords_[i*dimension_];
+            for (size_t row = 0; row < dimension_; ++row) {
+                rotated[i*dimension_ + row] = inner_product(pt, pt + dimension_,
+                    forest_tree.rotation.begin() + row*dimension_, T(0));
+            }
+        }
+    }
+
+    vector<uint32_t> order(ids_.size());
+    iota(order.begin(), order.end(), uint32_t(0));
+    forest_tree.nodes.reserve(ids_.size());
+    buildTree(order, 0, order.size(), forest_tree.rotation.empty() ? coords_ : rotated,
+              dimension_, rng, forest_tree.nodes);
+}
+
+template <typename T>
+void KdForest<T>::buildTrees(const size_t& tree_count, const bool& rotate) {
+    trees_.resize(max(tree_count, size_t(1)));
+    if (rotate) {
+        mt19937 rng(random_seed_);
+        for (auto iter = trees_.begin(); iter != trees_.end(); ++iter) {
+            iter->rotation = getRandomRotation<T>(dimension_, rng);
+        }
+    }
+
+    // Trees are independent, so each thread builds every n-th tree
+    size_t thread_count = min(trees_.size(), size_t(max(thread::hardware_concurrency(), 1u)));
+    vector<thread> workers;
+    for (size_t worker = 0; worker < thread_count; ++worker) {
+        workers.push_back(thread([this, worker, thread_count]() {
+            for (size_t tree = worker; tree < trees_.size(); tree += thread_count) {
+                buildTree(tree);
+            }
+        }));
+    }
+    for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+        iter->join();
+    }
+}
+
+template <typename T>
+KdForest<T> KdForest<T>::buildKdForest(const vector<Point<T>*>& input_points,
+                                       const size_t& tree_count, const bool& rotate,
+                                       const typename KdTree<T>::Metric_t& metric) {
+    KdForest<T> forest;
+    forest.metric_ = metric;
+    if (input_points.empty())
+        return forest;
+    if (metric == KdTree<T>::Metric_t::INNER_PRODUCT) {
+        for (auto iter = input_points.begin(); iter != input_points.end(); ++iter) {
+            forest.max_norm_ = max(forest.max_norm_, getNorm(**iter));
+        }
+    }
+
+    forest.ids_.reserve(input_points.size());
+    for (auto iter = input_points.begin(); iter != input_points.end(); ++iter) {
+        KdTree<T>::appendSearchCoords((*iter)->begin(), (*iter)->getDimension(), metric,
+                                      forest.max_norm_, false, forest.coords_);
+        forest.ids_.push_back((*iter)->getIndex());
+    }
+    forest.dimension_ = forest.coords_.size()/forest.ids_.size();
+    forest.buildTrees(tree_count, rotate);
+    return forest;
+}
+
+template <typename T>
+KdForest<T> KdForest<T>::buildKdForest(const PointSet<T>& input_points, const size_t& tree_count,
+                                       const bool& rotate,
+                                       const typename KdTree<T>::Metric_t& metric) {
+    KdForest<T> forest;
+    forest.metric_ = metric;
+    if (input_points.empty())
+        return forest;
+
+    // The set is already a row-major buffer, read in place
+    const T* coords = input_points.data();
+    size_t dimension = input_points.getDimension();
+    size_t count = input_points.size();
+    if (metric == KdTree<T>::Metric_t::EUCLIDEAN) {
+        forest.coords_.assign(coords, coords + count*dimension);
+    }
+    else {
+        if (metric == KdTree<T>::Metric_t::INNER_PRODUCT) {
+            for (const T* pt = coords; pt != coords + count*dimension; pt += dimension) {
+                T norm = sqrt(inner_product(pt, pt + dimension, pt, T(0)));
+                forest.max_norm_ = max(forest.max_norm_, norm);
+            }
+        }
+        forest.coords_.reserve(count*(dimension + 1));
+        for (const T* pt = coords; pt != coords + count*dimension; pt += dimension) {
+            KdTree<T>::appendSearchCoords(pt, dimension, metric, forest.max_norm_, false, forest.coords_);
+        }
+    }
+    forest.ids_ = input_points.getIds();
+    forest.dimension_ = forest.coords_.size()/count;
+    forest.buildTrees(tree_count, rotate);
+    return forest;
+}
+
+template <typename T>
+size_t KdForest<T>::getTreeCount() const {
+    return trees_.size();
+}
+
+template <typename T>
+size_t KdForest<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+typename KdTree<T>::Metric_t KdForest<T>::getMetric() const {
+    return metric_;
+}
+
+template <typename T>
+bool KdForest<T>::isEmpty() const {
+    return ids_.empty();
+}
+
+template <typename T>
+pair<size_t, T> KdForest<T>::findNearest(const Point<T>& query, const size_t& checks) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    Point<T> search_query = KdTree<T>::transformPoint(query, metric_, max_norm_, true);
+    vector<Point<T>> tree_queries;
+    tree_queries.reserve(trees_.size());
+    for (auto iter = trees_.begin(); iter != trees_.end(); ++iter) {
+        tree_queries.push_back(iter->rotation.empty() ? search_query
+                                                      : rotatePoint(iter->rotation, search_query));
+    }
+
+    // Every tree holds every Point, so each is checked at most once
+    vector<uint64_t> checked((ids_.size() + 63)/64, 0);
+    size_t check_count = 0;
+    uint32_t best_point = 0;
+    T best_dist = numeric_limits<T>::max();
+
+    // Unexplored branches as {squared plane distance, {tree, node}}
+    typedef pair<T, pair<size_t, uint32_t>> Branch;
+    priority_queue<Branch, vector<Branch>, greater<Branch>> branches;
+
+    auto descend = [&](const size_t& tree, uint32_t node) {
+        const vector<FlatKdNode<T>>& nodes = trees_[tree].nodes;
+        const Point<T>& tree_query = tree_queries[tree];
+        while (node != FlatKdTree<T>::null_node_) {
+            const FlatKdNode<T>& forest_node = nodes[node];
+            uint32_t point = forest_node.point;
+            if (!(checked[point/64] & (uint64_t(1) << (point%64)))) {
+                checked[point/64] |= uint64_t(1) << (point%64);
+                ++check_count;
+                const T* pt = &coords_[size_t(point)*dimension_];
+                T distance = T(0);
+                for (size_t axis = 0; axis < dimension_; ++axis) {
+                    T diff = pt[axis] - search_query[axis];
+                    distance += diff*diff;
+                }
+                if (distance < best_dist) {
+                    best_dist = distance;
+                    best_point = point;
+                }
+            }
+
+            T plane_dist = tree_query[forest_node.split_axis] - forest_node.split_position;
+            uint32_t near_child = (plane_dist < T(0)) ? forest_node.left_child : forest_node.right_child;
+            uint32_t far_child = (plane_dist < T(0)) ? forest_node.right_child : forest_node.left_child;
+            if (far_child != FlatKdTree<T>::null_node_ && plane_dist*plane_dist < best_dist)
+                branches.push(make_pair(plane_dist*plane_dist, make_pair(tree, far_child)));
+            node = near_child;
+        }
+    };
+
+    for (size_t tree = 0; tree < trees_.size(); ++tree) {
+        descend(tree, 0);
+    }
+    while (!branches.empty() && (checks == 0 || check_count < checks)) {
+        Branch branch = branches.top();
+        branches.pop();
+        if (branch.first >= best_dist)
+            break;
+        descend(branch.second.first, branch.second.second);
+    }
+
+    return make_pair(ids_[best_point],
+                     KdTree<T>::transformScore(sqrt(best_dist), query, metric_, max_norm_));
+}
+
+template <typename T>
+void KdForest<T>::queryKdForest(const KdForest<T>& forest, const vector<Point<T>*>& query_points,
+                                const size_t& checks) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = forest.findNearest(**iter, checks);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+void KdForest<T>::queryKdForest(const KdForest<T>& forest, const PointSet<T>& query_points,
+                                const size_t& checks) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = forest.findNearest(query_points[i].toPoint(), checks);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class KdForest<float>;
+template class KdForest<double>;
+
+
+#endif /* KD_FOREST_CPP_ */
@@ -0,0 +1,114 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_FOREST_H_
+#define KD_FOREST_H_
+
+#include <vector>
+#include <utility>
+#include <random>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+#include "kd_flat_tree.h"
+
+// Forest of randomized KD-trees for approximate search in higher
+// dimensions. Every tree indexes the same Points, but splits on an axis
+// drawn at random among the axes of highest variance, optionally after a
+// random rotation of the space. A query descends all trees, then keeps
+// expanding the closest unexplored branch of any tree from one shared
+// priority queue until its budget of distance checks is spent.
+template <typename T=double>
+class KdForest {
+public:
+    // Number of highest-variance axes a split axis is drawn from
+    static size_t top_variance_axes_;
+
+    // Seed of the random split axes and rotations (tree i uses seed + i)
+    static unsigned int random_seed_;
+
+private:
+    // One randomized tree. Nodes are in preorder and rotation is empty
+    // when the tree splits in the original space.
+    struct ForestTree {
+        std::vector<T> rotation;
+        std::vector<FlatKdNode<T>> nodes;
+    };
+
+    size_t dimension_ = 0;
+    std::vector<ForestTree> trees_;
+    std::vector<T> coords_;                 // Row-major Point coordinates
+    std::vector<size_t> ids_;               // Input file index of each Point
+    typename KdTree<T>::Metric_t metric_ = KdTree<T>::Metric_t::EUCLIDEAN;
+    T max_norm_ = T(0);
+
+    // Build one tree over the Points in [begin, end) of order, appending
+    // nodes in preorder. coords holds the (rotated) build coordinates.
+    static uint32_t buildTree(std::vector<uint32_t>& order, const size_t& begin, const size_t& end,
+                              const std::vector<T>& coords, const size_t& dimension,
+                              std::mt19937& rng, std::vector<FlatKdNode<T>>& nodes);
+    void buildTree(const size_t& tree);
+
+    // Build tree_count trees over coords_ in parallel, on up to one thread
+    // per tree
+    void buildTrees(const size_t& tree_count, const bool& rotate);
+
+public:
+    // Constructors/Destructor
+    KdForest() = default;
+    ~KdForest() = default;
+
+    // Build tree_count randomized trees in parallel, on up to one thread
+    // per tree. rotate gives every tree its own random rotation.
+    static KdForest<T> buildKdForest(const std::vector<Point<T>*>& input_points,
+                                     const size_t& tree_count = 4, const bool& rotate = false,
+                                     const typename KdTree<T>::Metric_t& metric
+                                         = KdTree<T>::Metric_t::EUCLIDEAN);
+    static KdForest<T> buildKdForest(const PointSet<T>& input_points,
+                                     const size_t& tree_count = 4, const bool& rotate = false,
+                                     const typename KdTree<T>::Metric_t& metric
+                                         = KdTree<T>::Metric_t::EUCLIDEAN);
+
+    // Member functions
+    size_t getTreeCount() const;
+    size_t getDimension() const;
+    typename KdTree<T>::Metric_t getMetric() const;
+    bool isEmpty() const;
+
+    // Approximate nearest neighbor under the forest's metric, computing at
+    // most checks distances (0 searches until the result is exact).
+    // Returns {point index, score}.
+    std::pair<size_t, T> findNearest(const Point<T>& query, const size_t& checks = 0) const;
+
+    // Query the forest for a set of points
+    static void queryKdForest(const KdForest<T>& forest, const std::vector<Point<T>*>& query_points,
+                              const size_t& checks = 0);
+    static void queryKdForest(const KdForest<T>& forest, const PointSet<T>& query_points,
+                              const size_t& checks = 0);
+};
+
+
+#include "kd_forest.cpp"
+
+#endif /* KD_FOREST_H_ */
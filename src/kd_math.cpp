@@ -27,24 +27,35 @@
 #include "kd_math.h"
 #include <functional>
 #include <numeric>
+#include <limits>
 #include <cmath>
 #include <vector>
 #include <cassert>
 #include <algorithm>
+#include <utility>
 
 using namespace std;
 
 template <typename T>
-Point<T>::Point(const vector<T>& vect,int idx) :
-                point_vect_(vect), index_(idx) {}
+Point<T>::Point(const vector<T>& vect, int idx, Arena* arena) :
+                point_vect_(vect.begin(), vect.end(), ArenaAllocator<T>(arena)), index_(idx) {}
 
 template <typename T>
 Point<T>::Point(const initializer_list<T>& elem_list, int idx) :
                 point_vect_(elem_list), index_(idx) {}
 
+template <typename T>
+Point<T>::Point(const T* coords, const size_t& dimension, int idx, Arena* arena) :
+                point_vect_(coords, coords + dimension, ArenaAllocator<T>(arena)), index_(idx) {}
+
+template <typename T>
+Point<T>::Point(const Point<T>& other, Arena* arena) :
+                point_vect_(other.point_vect_.begin(), other.point_vect_.end(),
+                            ArenaAllocator<T>(arena)), index_(other.index_) {}
+
 template <typename T>
 vector<T> Point<T>::getPointVector() const {
-    return point_vect_;
+    return vector<T>(point_vect_.begin(), point_vect_.end());
 }
 
 template <typename T>
@@ -69,12 +80,12 @@ typename Point<T>::const_iterator Point<T>::begin() const{
 
 template <typename T>
 typename Point<T>::iterator Point<T>::end() {
-    return  (begin() + getDimension()-1);
+    return  (begin() + getDimension());
 }
 
 template <typename T>
 typename Point<T>::const_iterator Point<T>::end() const {
-    return  (begin() + getDimension()-1);
+    return  (begin() + getDimension());
 }
 
 template <typename T>
@@ -172,45 +183,312 @@ T getDistance(const Point<T>& pt1, const Point<T>& pt2) {
     return dist;
 }
 
+template <typename T>
+T dotProduct(const Point<T>& pt1, const Point<T>& pt2) {
+    assert(pt1.getDimension() == pt2.getDimension());
+    return inner_product(pt1.begin(), pt1.end(), pt2.begin(), T(0.0));
+}
+
+template <typename T>
+T getNorm(const Point<T>& pt) {
+    return sqrt(dotProduct(pt, pt));
+}
+
+template <typename T>
+Point<T> normalize(const Point<T>& pt) {
+    T norm = getNorm(pt);
+    if (norm == T(0.0))
+        return pt;
+    vector<T> unit_vect;
+    unit_vect.reserve(pt.getDimension());
+    for (auto iter = pt.begin(); iter != pt.end(); ++iter) {
+        unit_vect.push_back(*iter / norm);
+    }
+    return Point<T>(unit_vect, pt.getIndex());
+}
+
+template <typename T>
+vector<T> getRandomRotation(const size_t& dimension, mt19937& rng) {
+    normal_distribution<double> gaussian(0.0, 1.0);
+    vector<double> rows(dimension*dimension);
+    for (size_t row = 0; row < dimension; ++row) {
+        double* current = &rows[row*dimension];
+        double norm = 0.0;
+        // Redraw the (unlikely) rows that depend on the previous ones
+        while (norm < 1e-6) {
+            for (size_t col = 0; col < dimension; ++col)
+                current[col] = gaussian(rng);
+            for (size_t prev = 0; prev < row; ++prev) {
+                const double* previous = &rows[prev*dimension];
+                double projection = inner_product(current, current + dimension, previous, 0.0);
+                for (size_t col = 0; col < dimension; ++col)
+                    current[col] -= projection*previous[col];
+            }
+            norm = sqrt(inner_product(current, current + dimension, current, 0.0));
+        }
+        for (size_t col = 0; col < dimension; ++col)
+            current[col] /= norm;
+    }
+    return vector<T>(rows.begin(), rows.end());
+}
+
+template <typename T>
+Point<T> rotatePoint(const vector<T>& rotation, const Point<T>& pt) {
+    size_t dimension = pt.getDimension();
+    assert(rotation.size() == dimension*dimension);
+    vector<T> rotated(dimension);
+    for (size_t row = 0; row < dimension; ++row)
+        rotated[row] = inner_product(pt.begin(), pt.end(), rotation.begin() + row*dimension, T(0));
+    return Point<T>(rotated, pt.getIndex());
+}
+
+template <typename T>
+vector<T> getPrincipalAxes(const vector<Point<T>*>& data, vector<T>& variances) {
+    assert(!data.empty());
+    size_t dimension = data[0]->getDimension();
+
+    // Covariance matrix, accumulated in double precision
+    vector<double> mean(dimension, 0.0);
+    for (auto iter = data.begin(); iter != data.end(); ++iter) {
+        for (size_t axis = 0; axis < dimension; ++axis)
+            mean[axis] += (**iter)[axis];
+    }
+    for (size_t axis = 0; axis < dimension; ++axis)
+        mean[axis] /= data.size();
+    vector<double> covariance(dimension*dimension, 0.0);
+    vector<double> centered(dimension);
+    for (auto iter = data.begin(); iter != data.end(); ++iter) {
+        for (size_t axis = 0; axis < dimension; ++axis)
+            centered[axis] = (**iter)[axis] - mean[axis];
+        for (size_t row = 0; row < dimension; ++row) {
+            for (size_t col = row; col < dimension; ++col)
+                covariance[row*dimension + col] += centered[row]*centered[col];
+        }
+    }
+    for (size_t row = 0; row < dimension; ++row) {
+        for (size_t col = row; col < dimension; ++col) {
+            covariance[row*dimension + col] /= data.size();
+            covariance[col*dimension + row] = covariance[row*dimension + col];
+        }
+    }
+
+    // Rotate away off-diagonal entries until the matrix is diagonal.
+    // Columns of eigenvectors accumulate the rotations.
+    vector<double> eigenvectors(dimension*dimension, 0.0);
+    for (size_t axis = 0; axis < dimension; ++axis)
+        eigenvectors[axis*dimension + axis] = 1.0;
+    for (size_t sweep = 0; sweep < 100; ++sweep) {
+        double off_diagonal = 0.0;
+        double diagonal = 0.0;
+        for (size_t row = 0; row < dimension; ++row) {
+            diagonal += covariance[row*dimension + row]*covariance[row*dimension + row];
+            for (size_t col = row+1; col < dimension; ++col)
+                off_diagonal += covariance[row*dimension + col]*covariance[row*dimension + col];
+        }
+        if (off_diagonal <= 1e-24*diagonal)
+            break;
+
+        for (size_t p = 0; p < dimension; ++p) {
+            for (size_t q = p+1; q < dimension; ++q) {
+                double apq = covariance[p*dimension + q];
+                if (apq == 0.0)
+                    continue;
+                double theta = (covariance[q*dimension + q] - covariance[p*dimension + p])/(2.0*apq);
+                double t = ((theta >= 0.0) ? 1.0 : -1.0)/(abs(theta) + sqrt(theta*theta + 1.0));
+                double c = 1.0/sqrt(t*t + 1.0);
+                double s = t*c;
+                for (size_t k = 0; k < dimension; ++k) {
+                    double akp = covariance[k*dimension + p];
+                    double akq = covariance[k*dimension + q];
+                    covariance[k*dimension + p] = c*akp - s*akq;
+                    covariance[k*dimension + q] = s*akp + c*akq;
+                }
+                for (size_t k = 0; k < dimension; ++k) {
+                    double apk = covariance[p*dimension + k];
+                    double aqk = covariance[q*dimension + k];
+                    covariance[p*dimension + k] = c*apk - s*aqk;
+                    covariance[q*dimension + k] = s*apk + c*aqk;
+                }
+                for (size_t k = 0; k < dimension; ++k) {
+                    double vkp = eigenvectors[k*dimension + p];
+                    double vkq = eigenvectors[k*dimension + q];
+                    eigenvectors[k*dimension + p] = c*vkp - s*vkq;
+                    eigenvectors[k*dimension + q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+
+    vector<size_t> order(dimension);
+    iota(order.begin(), order.end(), size_t(0));
+    stable_sort(order.begin(), order.end(), [&covariance, &dimension](const size_t& a, const size_t& b) {
+        return covariance[a*dimension + a] > covariance[b*dimension + b];
+    });
+    vector<T> axes(dimension*dimension);
+    variances.resize(dimension);
+    for (size_t row = 0; row < dimension; ++row) {
+        variances[row] = T(max(covariance[order[row]*dimension + order[row]], 0.0));
+        for (size_t col = 0; col < dimension; ++col)
+            axes[row*dimension + col] = T(eigenvectors[col*dimension + order[row]]);
+    }
+    return axes;
+}
+
 // Properties of a set of Points for each dimension
 // Output parameters are {min, max, range, mean, variance};
 template <typename T>
 std::vector<Point<T>> getDistributionParams(const std::vector<Point<T>*>& data) {
-    typename vector<Point<T>*>::const_iterator iter;
-
     size_t dimension = (*data.begin())->getDimension();
-    size_t data_size = data.size();
-    vector<T> zeros(dimension, 0);
-    vector<T> total_pts(dimension, data_size);
-
-    Point<T> data_min((*data.begin())->getPointVector());
-    Point<T> data_max((*data.begin())->getPointVector());
-    Point<T> data_range(zeros);
-    Point<T> data_mean(zeros);
-    Point<T> data_variance(zeros);
-    Point<T> total_points(total_pts);
-
-    // Calculate Min, Max and Mean of each dimension of the dataset
-    for (iter = data.begin(); iter != data.end(); ++iter) {
-        data_mean = data_mean + (**iter);
-        data_min = elemwiseMin(data_min, (**iter));
-        data_max = elemwiseMax(data_max, (**iter));
+    vector<T> data_min((*data.begin())->begin(), (*data.begin())->end());
+    vector<T> data_max = data_min;
+    vector<T> data_mean(dimension, T(0));
+    vector<T> sum_squares(dimension, T(0));
+
+    // Single fused pass over the coordinates: min, max and Welford's
+    // running mean and sum of squared deviations of each dimension
+    T* min_ptr = data_min.data();
+    T* max_ptr = data_max.data();
+    T* mean_ptr = data_mean.data();
+    T* sq_ptr = sum_squares.data();
+    size_t count = 0;
+    for (auto iter = data.begin(); iter != data.end(); ++iter) {
+        const T* coords = (*iter)->begin();
+        T inv_count = T(1)/T(++count);
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            T value = coords[axis];
+            min_ptr[axis] = (value < min_ptr[axis]) ? value : min_ptr[axis];
+            max_ptr[axis] = (value > max_ptr[axis]) ? value : max_ptr[axis];
+            T delta = value - mean_ptr[axis];
+            mean_ptr[axis] += delta*inv_count;
+            sq_ptr[axis] += delta*(value - mean_ptr[axis]);
+        }
     }
-    data_mean = data_mean / total_points;
-    data_range = data_max - data_min;
 
-    // Calculate variance of the dataset
-    for (iter = data.begin(); iter != data.end(); ++iter) {
-        data_variance = data_variance + ((**iter - data_mean)*(**iter - data_mean));
+    vector<T> data_range(dimension), data_variance(dimension);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        data_range[axis] = data_max[axis] - data_min[axis];
+        data_variance[axis] = sum_squares[axis]*(T(1)/T(count));
     }
-    data_variance = data_variance/total_points;
 
-    vector<Point<T>> distro_params = {data_min, data_max, data_range, data_mean,
-                                                                data_variance};
+    vector<Point<T>> distro_params = {Point<T>(data_min), Point<T>(data_max), Point<T>(data_range),
+                                      Point<T>(data_mean), Point<T>(data_variance)};
 
     return distro_params;
 }
 
+template <typename T>
+vector<T> getBoundingBox(const vector<Point<T>*>& data) {
+    size_t dimension = (*data.begin())->getDimension();
+    vector<T> box((*data.begin())->begin(), (*data.begin())->end());
+    box.insert(box.end(), (*data.begin())->begin(), (*data.begin())->end());
+    T* min_ptr = box.data();
+    T* max_ptr = box.data() + dimension;
+    for (auto iter = data.begin(); iter != data.end(); ++iter) {
+        const T* coords = (*iter)->begin();
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            T value = coords[axis];
+            min_ptr[axis] = (value < min_ptr[axis]) ? value : min_ptr[axis];
+            max_ptr[axis] = (value > max_ptr[axis]) ? value : max_ptr[axis];
+        }
+    }
+    return box;
+}
+
+template <typename T>
+uint64_t getMortonCode(const Point<T>& pt, const Point<T>& data_min, const Point<T>& data_range) {
+    return getMortonCode(pt.begin(), pt.getDimension(), data_min.begin(), data_range.begin());
+}
+
+template <typename T>
+uint64_t getMortonCode(const T* pt, const size_t& pt_dimension, const T* data_min, const T* data_range) {
+    // Only the first 64 axes contribute once there is one bit per axis.
+    // An axis gets no more bits than T's mantissa holds, so that the
+    // largest cell index converts exactly.
+    size_t dimension = min(pt_dimension, size_t(64));
+    size_t bits = min(64/dimension, size_t(numeric_limits<T>::digits));
+    uint64_t cells = (uint64_t(1) << bits) - 1;
+    uint64_t code = 0;
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        uint64_t cell = 0;
+        if (data_range[axis] > T(0)) {
+            T scaled = (pt[axis] - data_min[axis]) / data_range[axis];
+            cell = min(uint64_t(min(max(scaled, T(0)), T(1)) * T(cells)), cells);
+        }
+        for (size_t bit = 0; bit < bits; ++bit) {
+            code |= ((cell >> bit) & uint64_t(1)) << (bit*dimension + axis);
+        }
+    }
+    return code;
+}
+
+template <typename T>
+vector<size_t> getMortonOrder(const vector<Point<T>*>& data) {
+    vector<size_t> order;
+    if (data.empty())
+        return order;
+    vector<Point<T>> distro_params = getDistributionParams(data);
+    vector<pair<uint64_t, size_t>> keyed;
+    keyed.reserve(data.size());
+    for (size_t i = 0; i < data.size(); ++i) {
+        keyed.push_back(make_pair(getMortonCode(*data[i], distro_params[0], distro_params[2]), i));
+    }
+    stable_sort(keyed.begin(), keyed.end(),
+                [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+                    return a.first < b.first;
+                });
+    order.reserve(data.size());
+    for (auto iter = keyed.begin(); iter != keyed.end(); ++iter) {
+        order.push_back(iter->second);
+    }
+    return order;
+}
+
+template <typename T>
+vector<size_t> getMortonOrder(const T* coords, const size_t& count, const size_t& dimension) {
+    vector<size_t> order;
+    if (count == 0)
+        return order;
+    vector<T> data_min(coords, coords + dimension);
+    vector<T> data_range = data_min;
+    for (size_t i = 1; i < count; ++i) {
+        const T* pt = coords + i*dimension;
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            data_min[axis] = min(data_min[axis], pt[axis]);
+            data_range[axis] = max(data_range[axis], pt[axis]);
+        }
+    }
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        data_range[axis] -= data_min[axis];
+    }
+
+    vector<pair<uint64_t, size_t>> keyed;
+    keyed.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keyed.push_back(make_pair(getMortonCode(coords + i*dimension, dimension,
+                                                data_min.data(), data_range.data()), i));
+    }
+    stable_sort(keyed.begin(), keyed.end(),
+                [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+                    return a.first < b.first;
+                });
+    order.reserve(count);
+    for (auto iter = keyed.begin(); iter != keyed.end(); ++iter) {
+        order.push_back(iter->second);
+    }
+    return order;
+}
+
+template <typename T>
+void sortByMortonCode(vector<Point<T>*>& data) {
+    vector<size_t> order = getMortonOrder(data);
+    vector<Point<T>*> sorted;
+    sorted.reserve(data.size());
+    for (auto iter = order.begin(); iter != order.end(); ++iter) {
+        sorted.push_back(data[*iter]);
+    }
+    data.swap(sorted);
+}
+
 // Calculates the approximate median using binapprox algorithm
 template <typename T>
 T getApproxMedian(const vector<Point<T>*>& data, const size_t& split_axis,
@@ -221,22 +499,21 @@ T getApproxMedian(const vector<Point<T>*>& data, const size_t& split_axis,
     T lower_limit = mean - std_deviation;
     size_t sample_count = data.size();
 
-    if (sample_count <= 2) {
-        vector<T> test = (*data.begin())->getPointVector();
-        return test[split_axis];
-    }
+    if (sample_count <= 2)
+        return (**data.begin())[split_axis];
+    // All points share the same coordinate along this axis
+    if (std_deviation == T(0.0))
+        return mean;
 
     // Build histrogram for the Point distribution
     int bin_id;
     int bin_count = 128;
     T bin_size = (2*std_deviation)/bin_count;
     vector<int> histogram(bin_count,0);
-    vector<T> sample;
 
     typename vector<Point<T>*>::const_iterator iter;
     for (iter = data.begin(); iter != data.end(); ++iter) {
-        sample = (*iter)->getPointVector();
-        bin_id = std::round((sample[split_axis]-lower_limit) / bin_size);
+        bin_id = std::round(((**iter)[split_axis]-lower_limit) / bin_size);
         if (bin_id < 0)
             bin_id = 0;
         else if (bin_id > bin_count-1)
@@ -256,6 +533,19 @@ T getApproxMedian(const vector<Point<T>*>& data, const size_t& split_axis,
     return median;
 }
 
+// Exact median along one axis, by selection over a copy of the coordinates
+template <typename T>
+T getExactMedian(const vector<Point<T>*>& data, const size_t& split_axis) {
+    vector<T> values;
+    values.reserve(data.size());
+    for (auto iter = data.begin(); iter != data.end(); ++iter) {
+        values.push_back((**iter)[split_axis]);
+    }
+    auto median = values.begin() + values.size()/2;
+    nth_element(values.begin(), median, values.end());
+    return *median;
+}
+
 template class Point<float>;
 template class Point<double>;
 
@@ -25,6 +25,9 @@
 
 #include <vector>
 #include <stddef.h>
+#include <stdint.h>
+#include <random>
+#include "kd_arena.h"
 #include <cereal/cereal.hpp>
 #include <cereal/types/vector.hpp>
 
@@ -34,13 +37,21 @@
 template <class T = double>
 class Point{
 private:
-    std::vector<T> point_vect_; // K-d point vector
+    std::vector<T, ArenaAllocator<T>> point_vect_; // K-d point vector
     size_t index_;              // Index of point in input file
 public:
     // Constructors/Destructor
     Point() = default;
-    Point(const std::vector<T>& vect, int idx=-1);
+    // Coordinates are allocated from arena when given, which must then
+    // outlive the Point; copies of the Point always use the heap
+    Point(const std::vector<T>& vect, int idx=-1, Arena* arena=nullptr);
     Point(const std::initializer_list<T>& elem_list, int idx=-1);
+    Point(const T* coords, const size_t& dimension, int idx=-1, Arena* arena=nullptr);
+    Point(const Point<T>& other, Arena* arena);
+    Point(const Point<T>& other) = default;
+    Point(Point<T>&& other) = default;
+    Point& operator=(const Point<T>& other) = default;
+    Point& operator=(Point<T>&& other) = default;   // Takes over other's arena
     ~Point() = default;
 
     // Iterator for traversing individual coordinates of a point
@@ -103,16 +114,73 @@ Point<T> elemwiseMax (const Point<T>& pt1, const Point<T>& pt2);
 template <typename T = double>
 T getDistance(const Point<T>& pt1, const Point<T>& pt2);
 
+// Inner (dot) product of two Points
+template <typename T = double>
+T dotProduct(const Point<T>& pt1, const Point<T>& pt2);
+
+// Euclidean norm of a Point
+template <typename T = double>
+T getNorm(const Point<T>& pt);
+
+// Point scaled to unit norm (zero vectors are returned unchanged)
+template <typename T = double>
+Point<T> normalize(const Point<T>& pt);
+
+// Random orthonormal (rotation) matrix of size dimension x dimension,
+// row-major, from Gram-Schmidt orthonormalization of a Gaussian matrix
+template <typename T = double>
+std::vector<T> getRandomRotation(const size_t& dimension, std::mt19937& rng);
+
+// Product of a row-major dimension x dimension matrix and a Point
+template <typename T = double>
+Point<T> rotatePoint(const std::vector<T>& rotation, const Point<T>& pt);
+
+// Principal axes of a set of Points, found with the cyclic Jacobi
+// eigenvalue algorithm on their covariance matrix. Rows of the returned
+// row-major matrix are the axes by decreasing variance; variances receives
+// the variance along each of them.
+template <typename T = double>
+std::vector<T> getPrincipalAxes(const std::vector<Point<T>*>& data, std::vector<T>& variances);
+
 // Properties of a set of Points for each dimension
 // Output parameters are {min, max, range, mean, variance};
 template <typename T = double>
 std::vector<Point<T>> getDistributionParams(const std::vector<Point<T>*>& data);
 
+// Bounding box of a set of Points as {min of each axis, max of each axis},
+// computed in one pass without mean or variance
+template <typename T = double>
+std::vector<T> getBoundingBox(const std::vector<Point<T>*>& data);
+
+// Morton (Z-order) code of a Point, with each axis quantized over
+// [data_min, data_min + data_range] and the bits of all axes interleaved
+template <typename T = double>
+uint64_t getMortonCode(const Point<T>& pt, const Point<T>& data_min, const Point<T>& data_range);
+template <typename T = double>
+uint64_t getMortonCode(const T* pt, const size_t& dimension, const T* data_min, const T* data_range);
+
+// Order of a set of Points along the Morton curve of their bounding box,
+// as positions into data
+template <typename T = double>
+std::vector<size_t> getMortonOrder(const std::vector<Point<T>*>& data);
+
+// Same order for count row-major Points of a coordinate buffer
+template <typename T = double>
+std::vector<size_t> getMortonOrder(const T* coords, const size_t& count, const size_t& dimension);
+
+// Sort a set of Points along the Morton curve of their bounding box
+template <typename T = double>
+void sortByMortonCode(std::vector<Point<T>*>& data);
+
 // Calculates the approximate median using binapprox algorithm
 template <typename T = double>
 T getApproxMedian(const std::vector<Point<T>*>& data, const size_t& split_axis,
                          const Point<T>& data_mean, const Point<T>& data_variance);
 
+// Calculates the exact median along one axis, for small sets of Points
+template <typename T = double>
+T getExactMedian(const std::vector<Point<T>*>& data, const size_t& split_axis);
+
 
 #include "kd_math.cpp"
 
@@ -0,0 +1,349 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_PAGED_TREE_CPP_
+#define KD_PAGED_TREE_CPP_
+
+#include <fstream>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_paged_tree.h"
+
+using namespace std;
+
+// SET NUMBER OF RESIDENT TOP LEVELS HERE
+template <typename T>
+size_t PagedKdTree<T>::resident_levels_ = 10;
+
+// SET PAGE SIZE IN BYTES HERE
+template <typename T>
+size_t PagedKdTree<T>::page_bytes_ = 4096;
+
+template <typename T>
+PagedKdTree<T> PagedKdTree<T>::open(const string& file, const size_t& cache_pages) {
+    PagedKdTree<T> tree;
+    tree.cache_ = make_shared<PageCache>();
+    tree.cache_->capacity = max(cache_pages, size_t(1));
+    ifstream& in_stream = tree.cache_->stream;
+    in_stream.open(file, ios::binary);
+    vector<uint64_t> header;
+    if (!readSection(in_stream, header, 10) || header[0] != flat_file_magic
+        || header[1] != sizeof(T))
+        throw runtime_error("Not a flat KD-tree file of this precision: " + file);
+
+    vector<T> max_norm;
+    if (!readSection(in_stream, max_norm, 1)
+        || !readSection(in_stream, tree.rotation_, header[9],
+                        getNodeSectionAlignment<T>(header[7], header[8])))
+        throw runtime_error("Truncated flat KD-tree file: " + file);
+    tree.dimension_ = header[2];
+    tree.node_count_ = header[3];
+    tree.point_count_ = header[4];
+    tree.has_bounds_ = header[5] > 0;
+    tree.metric_ = typename KdTree<T>::Metric_t(header[6]);
+    tree.max_norm_ = max_norm[0];
+
+    // Sections follow each other as written by FlatKdTree<T>
+    size_t dimension = tree.dimension_;
+    tree.offsets_.resize(4);
+    tree.offsets_[0] = uint64_t(in_stream.tellg());
+    tree.offsets_[1] = alignSection(tree.offsets_[0] + tree.node_count_*sizeof(FlatKdNode<T>));
+    tree.offsets_[2] = alignSection(tree.offsets_[1] + tree.point_count_*dimension*sizeof(T));
+    tree.offsets_[3] = alignSection(tree.offsets_[2] + tree.point_count_*sizeof(size_t));
+    tree.page_nodes_ = max(page_bytes_/sizeof(FlatKdNode<T>), size_t(1));
+    tree.page_points_ = max(page_bytes_/(max(dimension, size_t(1))*sizeof(T)), size_t(1));
+    if (tree.node_count_ == 0)
+        return tree;
+
+    // Load the top levels breadth-first
+    vector<uint32_t> level(1, 0);
+    for (size_t depth = 0; depth < resident_levels_ && !level.empty(); ++depth) {
+        vector<uint32_t> next_level;
+        for (auto iter = level.begin(); iter != level.end(); ++iter) {
+            vector<FlatKdNode<T>> record;
+            vector<T> coords, box;
+            vector<size_t> id;
+            tree.readRecords(0, *iter, 1, record);
+            tree.readRecords(1, size_t(record[0].point)*dimension, dimension, coords);
+            tree.readRecords(2, record[0].point, 1, id);
+            if (tree.has_bounds_) {
+                tree.readRecords(3, size_t(*iter)*2*dimension, 2*dimension, box);
+                tree.resident_bounds_.insert(tree.resident_bounds_.end(), box.begin(), box.end());
+            }
+            tree.resident_slots_[*iter] = tree.resident_nodes_.size();
+            tree.resident_nodes_.push_back(record[0]);
+            tree.resident_coords_.insert(tree.resident_coords_.end(), coords.begin(), coords.end());
+            tree.resident_ids_.push_back(id[0]);
+
+            if (record[0].left_child != FlatKdTree<T>::null_node_)
+                next_level.push_back(record[0].left_child);
+            if (record[0].right_child != FlatKdTree<T>::null_node_)
+                next_level.push_back(record[0].right_child);
+        }
+        level.swap(next_level);
+    }
+    return tree;
+}
+
+template <typename T>
+template <typename V>
+void PagedKdTree<T>::readRecords(const size_t& section, const size_t& first, const size_t& count,
+                                 vector<V>& records) const {
+    ifstream& in_stream = cache_->stream;
+    records.resize(count);
+    in_stream.seekg(offsets_[section] + first*sizeof(V));
+    in_stream.read(reinterpret_cast<char*>(records.data()), count*sizeof(V));
+    if (!in_stream.good())
+        throw runtime_error("Cannot read flat KD-tree file");
+}
+
+template <typename T>
+shared_ptr<const typename PagedKdTree<T>::Page> PagedKdTree<T>::getPage(const size_t& index,
+                                                                        const bool& is_point_page) const {
+    uint64_t key = (uint64_t(index) << 1) | (is_point_page ? 1 : 0);
+    PageCache& cache = *cache_;
+    lock_guard<mutex> lock(cache.mutex);
+    auto found = cache.pages.find(key);
+    if (found != cache.pages.end()) {
+        ++cache.hits;
+        cache.recency.splice(cache.recency.begin(), cache.recency, found->second.second);
+        return found->second.first;
+    }
+
+    ++cache.misses;
+    shared_ptr<Page> page = make_shared<Page>();
+    if (is_point_page) {
+        size_t first = index*page_points_;
+        size_t count = min(page_points_, point_count_ - first);
+        readRecords(1, first*dimension_, count*dimension_, page->coords);
+        readRecords(2, first, count, page->ids);
+    }
+    else {
+        size_t first = index*page_nodes_;
+        size_t count = min(page_nodes_, node_count_ - first);
+        readRecords(0, first, count, page->nodes);
+        if (has_bounds_)
+            readRecords(3, first*2*dimension_, count*2*dimension_, page->bounds);
+    }
+
+    cache.recency.push_front(key);
+    cache.pages[key] = make_pair(shared_ptr<const Page>(page), cache.recency.begin());
+    while (cache.pages.size() > cache.capacity) {
+        cache.pages.erase(cache.recency.back());
+        cache.recency.pop_back();
+    }
+    return page;
+}
+
+template <typename T>
+void PagedKdTree<T>::getNode(const uint32_t& node, const size_t& depth, NodeView& view) const {
+    if (depth < resident_levels_) {
+        auto found = resident_slots_.find(node);
+        if (found != resident_slots_.end()) {
+            size_t slot = found->second;
+            view.node = &resident_nodes_[slot];
+            view.bounds = has_bounds_ ? &resident_bounds_[slot*2*dimension_] : nullptr;
+            view.coords = &resident_coords_[slot*dimension_];
+            view.id = resident_ids_[slot];
+            return;
+        }
+    }
+
+    view.node_page = getPage(node/page_nodes_, false);
+    size_t offset = node % page_nodes_;
+    view.node = &view.node_page->nodes[offset];
+    view.bounds = has_bounds_ ? &view.node_page->bounds[offset*2*dimension_] : nullptr;
+}
+
+template <typename T>
+void PagedKdTree<T>::getPoint(NodeView& view) const {
+    uint32_t point = view.node->point;
+    view.point_page = getPage(point/page_points_, true);
+    size_t offset = point % page_points_;
+    view.coords = &view.point_page->coords[offset*dimension_];
+    view.id = view.point_page->ids[offset];
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getNodeCount() const {
+    return node_count_;
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+typename KdTree<T>::Metric_t PagedKdTree<T>::getMetric() const {
+    return metric_;
+}
+
+template <typename T>
+bool PagedKdTree<T>::isEmpty() const {
+    return node_count_ == 0;
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getResidentNodeCount() const {
+    return resident_nodes_.size();
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getCacheHits() const {
+    lock_guard<mutex> lock(cache_->mutex);
+    return cache_->hits;
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getCacheMisses() const {
+    lock_guard<mutex> lock(cache_->mutex);
+    return cache_->misses;
+}
+
+template <typename T>
+double PagedKdTree<T>::getCacheHitRate() const {
+    lock_guard<mutex> lock(cache_->mutex);
+    size_t lookups = cache_->hits + cache_->misses;
+    return (lookups > 0) ? double(cache_->hits)/double(lookups) : 0.0;
+}
+
+template <typename T>
+size_t PagedKdTree<T>::getCachedPageCount() const {
+    lock_guard<mutex> lock(cache_->mutex);
+    return cache_->pages.size();
+}
+
+template <typename T>
+void PagedKdTree<T>::resetCacheStats() {
+    lock_guard<mutex> lock(cache_->mutex);
+    cache_->hits = 0;
+    cache_->misses = 0;
+}
+
+template <typename T>
+vector<T> PagedKdTree<T>::toSearchQuery(const Point<T>& query) const {
+    if (metric_ == KdTree<T>::Metric_t::EUCLIDEAN && rotation_.empty())
+        return query.getPointVector();
+    Point<T> rotated = rotation_.empty() ? query : rotatePoint(rotation_, query);
+    return KdTree<T>::transformPoint(rotated, metric_, max_norm_, true).getPointVector();
+}
+
+template <typename T>
+void PagedKdTree<T>::getNearestNeighbor(const uint32_t& node, const size_t& depth, const T* query,
+                                        size_t& best_id, T& best_dist) const {
+    NodeView view;
+    getNode(node, depth, view);
+    if (view.bounds != nullptr) {
+        T box_dist = T(0);
+        for (size_t axis = 0; axis < dimension_; ++axis) {
+            T excess = max(view.bounds[axis] - query[axis],
+                           max(query[axis] - view.bounds[dimension_+axis], T(0)));
+            box_dist += excess*excess;
+        }
+        if (box_dist >= best_dist)
+            return;
+    }
+
+    if (view.coords == nullptr)
+        getPoint(view);
+    T distance = T(0);
+    for (size_t axis = 0; axis < dimension_; ++axis) {
+        T diff = view.coords[axis] - query[axis];
+        distance += diff*diff;
+    }
+    if (distance < best_dist) {
+        best_dist = distance;
+        best_id = view.id;
+    }
+    const FlatKdNode<T>& flat_node = *view.node;
+    if (flat_node.isLeaf())
+        return;
+
+    T plane_dist = query[flat_node.split_axis] - flat_node.split_position;
+    uint32_t near_child = (plane_dist < T(0)) ? flat_node.left_child : flat_node.right_child;
+    uint32_t far_child = (plane_dist < T(0)) ? flat_node.right_child : flat_node.left_child;
+    if (near_child != FlatKdTree<T>::null_node_)
+        getNearestNeighbor(near_child, depth+1, query, best_id, best_dist);
+    if (far_child != FlatKdTree<T>::null_node_ && plane_dist*plane_dist < best_dist)
+        getNearestNeighbor(far_child, depth+1, query, best_id, best_dist);
+}
+
+template <typename T>
+pair<size_t, T> PagedKdTree<T>::findNearest(const Point<T>& query) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    vector<T> search_query = toSearchQuery(query);
+    size_t best_id = numeric_limits<size_t>::max();
+    T best_dist = numeric_limits<T>::max();
+    getNearestNeighbor(0, 0, search_query.data(), best_id, best_dist);
+    return make_pair(best_id, KdTree<T>::transformScore(sqrt(best_dist), query, metric_, max_norm_));
+}
+
+template <typename T>
+void PagedKdTree<T>::queryPagedKdTree(const PagedKdTree<T>& tree,
+                                      const vector<Point<T>*>& query_points) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = tree.findNearest(**iter);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+void PagedKdTree<T>::queryPagedKdTree(const PagedKdTree<T>& tree,
+                                      const PointSet<T>& query_points) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = tree.findNearest(query_points[i].toPoint());
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class PagedKdTree<float>;
+template class PagedKdTree<double>;
+
+
+#endif /* KD_PAGED_TREE_CPP_ */
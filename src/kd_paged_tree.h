@@ -0,0 +1,164 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_PAGED_TREE_H_
+#define KD_PAGED_TREE_H_
+
+#include <vector>
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <utility>
+#include <unordered_map>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+#include "kd_flat_tree.h"
+
+// Read-only view of a flat KD-tree file (tree.kdx) that keeps only the top
+// levels in memory. Other nodes and Points are read from the file in pages
+// on first use and kept in a bounded LRU cache, so an index can be much
+// larger than the memory of the host that queries it. Copies share the
+// file and the cache, which are safe to use from several threads.
+template <typename T=double>
+class PagedKdTree {
+public:
+    // Levels of the tree loaded when the file is opened and never evicted
+    static size_t resident_levels_;
+
+    // Size of one page of node records or of Points
+    static size_t page_bytes_;
+
+private:
+    // A run of consecutive node records with their boxes, or of Points
+    // with their input file indexes
+    struct Page {
+        std::vector<FlatKdNode<T>> nodes;
+        std::vector<T> bounds;
+        std::vector<T> coords;
+        std::vector<size_t> ids;
+    };
+
+    // One node visit. Pages stay pinned while the view holds them, even if
+    // the cache evicts them meanwhile.
+    struct NodeView {
+        const FlatKdNode<T>* node = nullptr;
+        const T* bounds = nullptr;
+        const T* coords = nullptr;
+        size_t id = 0;
+        std::shared_ptr<const Page> node_page;
+        std::shared_ptr<const Page> point_page;
+    };
+
+    // Pages keyed by (page index << 1 | is Point page), most recent first
+    struct PageCache {
+        std::mutex mutex;
+        std::ifstream stream;
+        size_t capacity = 0;
+        std::list<uint64_t> recency;
+        std::unordered_map<uint64_t, std::pair<std::shared_ptr<const Page>,
+                                               std::list<uint64_t>::iterator>> pages;
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    size_t dimension_ = 0;
+    size_t node_count_ = 0;
+    size_t point_count_ = 0;
+    bool has_bounds_ = false;
+    typename KdTree<T>::Metric_t metric_ = KdTree<T>::Metric_t::EUCLIDEAN;
+    T max_norm_ = T(0);
+    std::vector<T> rotation_;
+    std::vector<uint64_t> offsets_;         // Node, coordinate, index and bounds sections
+    size_t page_nodes_ = 1;
+    size_t page_points_ = 1;
+
+    // Top levels, by node id
+    std::unordered_map<uint32_t, size_t> resident_slots_;
+    std::vector<FlatKdNode<T>> resident_nodes_;
+    std::vector<T> resident_bounds_;
+    std::vector<T> resident_coords_;
+    std::vector<size_t> resident_ids_;
+
+    std::shared_ptr<PageCache> cache_;
+
+    // Read count records of a section starting at a record index
+    template <typename V>
+    void readRecords(const size_t& section, const size_t& first, const size_t& count,
+                     std::vector<V>& records) const;
+
+    // Page from the cache, read from the file on a miss
+    std::shared_ptr<const Page> getPage(const size_t& index, const bool& is_point_page) const;
+
+    // Node record and box of a node, and its Point too if it is resident
+    void getNode(const uint32_t& node, const size_t& depth, NodeView& view) const;
+
+    // Point of a paged node, read only once its box cannot prune it
+    void getPoint(NodeView& view) const;
+
+    // Map a query into the space the nodes and Points are stored in
+    std::vector<T> toSearchQuery(const Point<T>& query) const;
+
+    // Recursively find nearest neighbor. Distances are squared.
+    void getNearestNeighbor(const uint32_t& node, const size_t& depth, const T* query,
+                            size_t& best_id, T& best_dist) const;
+
+public:
+    // Constructors/Destructor
+    PagedKdTree() = default;
+    ~PagedKdTree() = default;
+
+    // Open a flat KD-tree file, caching at most cache_pages pages
+    static PagedKdTree<T> open(const std::string& file, const size_t& cache_pages = 1024);
+
+    // Member functions
+    size_t getNodeCount() const;
+    size_t getDimension() const;
+    typename KdTree<T>::Metric_t getMetric() const;
+    bool isEmpty() const;
+    size_t getResidentNodeCount() const;
+
+    // Page cache statistics since opening or the last reset
+    size_t getCacheHits() const;
+    size_t getCacheMisses() const;
+    double getCacheHitRate() const;
+    size_t getCachedPageCount() const;
+    void resetCacheStats();
+
+    // Find the nearest neighbor of a single query under the tree's metric.
+    // Returns {point index, score}.
+    std::pair<size_t, T> findNearest(const Point<T>& query) const;
+
+    // Query paged KD tree for a set of points
+    static void queryPagedKdTree(const PagedKdTree<T>& tree,
+                                 const std::vector<Point<T>*>& query_points);
+    static void queryPagedKdTree(const PagedKdTree<T>& tree, const PointSet<T>& query_points);
+};
+
+
+#include "kd_paged_tree.cpp"
+
+#endif /* KD_PAGED_TREE_H_ */
@@ -0,0 +1,156 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_POINT_SET_CPP_
+#define KD_POINT_SET_CPP_
+
+#include <vector>
+#include <new>
+#include <string>
+#include <stdexcept>
+#include "kd_math.h"
+#include "kd_arena.h"
+#include "kd_point_set.h"
+
+using namespace std;
+
+template <typename T>
+PointView<T>::PointView(const T* coords, const size_t& dimension, const size_t& index) :
+                        coords_(coords), dimension_(dimension), index_(index) {}
+
+template <typename T>
+typename PointView<T>::const_iterator PointView<T>::begin() const {
+    return coords_;
+}
+
+template <typename T>
+typename PointView<T>::const_iterator PointView<T>::end() const {
+    return coords_ + dimension_;
+}
+
+template <typename T>
+T PointView<T>::operator[] (size_t index) const {
+    return coords_[index];
+}
+
+template <typename T>
+size_t PointView<T>::getIndex() const {
+    return index_;
+}
+
+template <typename T>
+size_t PointView<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+Point<T> PointView<T>::toPoint(Arena* arena) const {
+    return Point<T>(coords_, dimension_, int(index_), arena);
+}
+
+template <typename T>
+PointSet<T>::PointSet(const size_t& dimension) : dimension_(dimension) {}
+
+template <typename T>
+PointSet<T>::PointSet(const vector<Point<T>*>& points) {
+    if (!points.empty())
+        reserve(points.size());
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        push_back(**iter);
+    }
+}
+
+template <typename T>
+void PointSet<T>::reserve(const size_t& count) {
+    coords_.reserve(count*dimension_);
+    ids_.reserve(count);
+}
+
+template <typename T>
+void PointSet<T>::push_back(const T* coords, const size_t& dimension, const size_t& id) {
+    if (dimension_ == 0 && ids_.empty()) {
+        dimension_ = dimension;
+        coords_.reserve(ids_.capacity()*dimension_);
+    }
+    if (dimension != dimension_) {
+        throw invalid_argument("Point of dimension " + to_string(dimension)
+                               + " added to a set of dimension " + to_string(dimension_));
+    }
+    coords_.insert(coords_.end(), coords, coords + dimension);
+    ids_.push_back(id);
+}
+
+template <typename T>
+void PointSet<T>::push_back(const Point<T>& point) {
+    push_back(point.begin(), point.getDimension(), point.getIndex());
+}
+
+template <typename T>
+size_t PointSet<T>::size() const {
+    return ids_.size();
+}
+
+template <typename T>
+bool PointSet<T>::empty() const {
+    return ids_.empty();
+}
+
+template <typename T>
+size_t PointSet<T>::getDimension() const {
+    return dimension_;
+}
+
+template <typename T>
+PointView<T> PointSet<T>::operator[] (const size_t& index) const {
+    return PointView<T>(&coords_[index*dimension_], dimension_, ids_[index]);
+}
+
+template <typename T>
+const T* PointSet<T>::data() const {
+    return coords_.data();
+}
+
+template <typename T>
+const vector<size_t>& PointSet<T>::getIds() const {
+    return ids_;
+}
+
+template <typename T>
+vector<Point<T>*> PointSet<T>::getPointers(Arena& arena) const {
+    vector<Point<T>*> points;
+    points.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        void* memory = arena.allocate(sizeof(Point<T>), alignof(Point<T>));
+        points.push_back(new (memory) Point<T>(&coords_[i*dimension_], dimension_,
+                                               int(ids_[i]), &arena));
+    }
+    return points;
+}
+
+template class PointView<float>;
+template class PointView<double>;
+template class PointSet<float>;
+template class PointSet<double>;
+
+
+#endif /* KD_POINT_SET_CPP_ */
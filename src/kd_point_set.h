@@ -0,0 +1,96 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_POINT_SET_H_
+#define KD_POINT_SET_H_
+
+#include <vector>
+#include <stddef.h>
+#include "kd_math.h"
+#include "kd_arena.h"
+
+// Non-owning view of one Point of a PointSet. Valid until the set is
+// modified or destroyed.
+template <typename T=double>
+class PointView {
+private:
+    const T* coords_;
+    size_t dimension_;
+    size_t index_;          // Index of point in input file
+public:
+    PointView(const T* coords, const size_t& dimension, const size_t& index);
+
+    typedef const T* const_iterator;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    T operator[] (size_t index) const;
+
+    size_t getIndex() const;
+    size_t getDimension() const;
+
+    // Owning copy, with coordinates allocated from arena when given
+    Point<T> toPoint(Arena* arena=nullptr) const;
+};
+
+// Owning set of Points of one dimension, stored as a single row-major
+// coordinate buffer and an id column instead of one object per Point
+template <typename T=double>
+class PointSet {
+private:
+    size_t dimension_ = 0;
+    std::vector<T> coords_;     // Row-major Point coordinates
+    std::vector<size_t> ids_;   // Input file index of each Point
+public:
+    // Constructors/Destructor
+    PointSet() = default;
+    explicit PointSet(const size_t& dimension);
+    explicit PointSet(const std::vector<Point<T>*>& points);
+    ~PointSet() = default;
+
+    void reserve(const size_t& count);
+
+    // Append a Point; the first Point added to a set without a dimension
+    // sets it. Throws std::invalid_argument on a dimension mismatch.
+    void push_back(const T* coords, const size_t& dimension, const size_t& id);
+    void push_back(const Point<T>& point);
+
+    size_t size() const;
+    bool empty() const;
+    size_t getDimension() const;
+
+    PointView<T> operator[] (const size_t& index) const;
+
+    const T* data() const;                      // Row-major coordinates
+    const std::vector<size_t>& getIds() const;
+
+    // Copies of the Points for the pointer-based builders and queries,
+    // allocated with their coordinates from arena, which must outlive them.
+    // Only KdTree::buildKdTree goes through this, as its nodes copy their
+    // Points anyway; the other PointSet overloads read data() in place.
+    std::vector<Point<T>*> getPointers(Arena& arena) const;
+};
+
+#include "kd_point_set.cpp"
+
+#endif // KD_POINT_SET_H_ //
@@ -0,0 +1,262 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_QUANTIZED_CPP_
+#define KD_QUANTIZED_CPP_
+
+#include <fstream>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "file_handler.h"
+#include "kd_math.h"
+#include "kd_point_set.h"
+#include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_quantized.h"
+
+using namespace std;
+
+template <typename T, typename Q>
+QuantizedKdTree<T, Q> QuantizedKdTree<T, Q>::quantize(const FlatKdTree<T>& tree,
+                                                      const Storage_t& storage,
+                                                      const string& exact_file) {
+    QuantizedKdTree<T, Q> quantized;
+    quantized.structure_ = tree;
+    vector<T>().swap(quantized.structure_.coords_);
+    quantized.storage_ = storage;
+
+    size_t dimension = tree.dimension_;
+    size_t count = tree.ids_.size();
+    if (count == 0)
+        return quantized;
+
+    // Per-axis min and range of the stored Points
+    vector<T> data_max(tree.coords_.begin(), tree.coords_.begin()+dimension);
+    quantized.offset_ = data_max;
+    for (size_t point = 1; point < count; ++point) {
+        const T* coords = &tree.coords_[point*dimension];
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            quantized.offset_[axis] = min(quantized.offset_[axis], coords[axis]);
+            data_max[axis] = max(data_max[axis], coords[axis]);
+        }
+    }
+    T levels = T(numeric_limits<Q>::max()) + T(1);
+    quantized.scale_.resize(dimension);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        quantized.scale_[axis] = (data_max[axis] - quantized.offset_[axis]) / levels;
+    }
+
+    quantized.codes_.resize(tree.coords_.size());
+    for (size_t i = 0; i < tree.coords_.size(); ++i) {
+        size_t axis = i % dimension;
+        T cell = T(0);
+        if (quantized.scale_[axis] > T(0)) {
+            cell = floor((tree.coords_[i] - quantized.offset_[axis]) / quantized.scale_[axis]);
+            cell = min(max(cell, T(0)), levels - T(1));
+        }
+        quantized.codes_[i] = Q(cell);
+    }
+
+    if (storage == Storage_t::MEMORY) {
+        quantized.exact_coords_ = tree.coords_;
+    }
+    else {
+        quantized.exact_file_ = exact_file;
+        ofstream out_stream(exact_file, ios::binary);
+        out_stream.write(reinterpret_cast<const char*>(tree.coords_.data()),
+                         tree.coords_.size()*sizeof(T));
+        out_stream.close();
+        quantized.exact_stream_ = make_shared<ifstream>(exact_file, ios::binary);
+        quantized.exact_mutex_ = make_shared<mutex>();
+        if (!quantized.exact_stream_->good())
+            throw runtime_error("Cannot open full precision data file: " + exact_file);
+    }
+    return quantized;
+}
+
+template <typename T, typename Q>
+bool QuantizedKdTree<T, Q>::isEmpty() const {
+    return structure_.isEmpty();
+}
+
+template <typename T, typename Q>
+size_t QuantizedKdTree<T, Q>::getDimension() const {
+    return structure_.dimension_;
+}
+
+template <typename T, typename Q>
+size_t QuantizedKdTree<T, Q>::getMemoryUsage() const {
+    return structure_.nodes_.size()*sizeof(FlatKdNode<T>) + structure_.ids_.size()*sizeof(size_t)
+           + structure_.bounds_.size()*sizeof(T) + codes_.size()*sizeof(Q)
+           + (offset_.size() + scale_.size() + exact_coords_.size())*sizeof(T);
+}
+
+template <typename T, typename Q>
+void QuantizedKdTree<T, Q>::getCellBounds(const uint32_t& point, const T* query,
+                                          T& lower, T& upper) const {
+    size_t dimension = structure_.dimension_;
+    const Q* codes = &codes_[size_t(point)*dimension];
+    lower = T(0);
+    upper = T(0);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        // Cells are widened slightly so rounding never excludes the Point
+        T slack = scale_[axis]*T(1e-3);
+        T cell_min = offset_[axis] + T(codes[axis])*scale_[axis] - slack;
+        T cell_max = cell_min + scale_[axis] + T(2)*slack;
+        T excess = max(cell_min - query[axis], max(query[axis] - cell_max, T(0)));
+        T reach = max(abs(query[axis] - cell_min), abs(query[axis] - cell_max));
+        lower += excess*excess;
+        upper += reach*reach;
+    }
+}
+
+template <typename T, typename Q>
+void QuantizedKdTree<T, Q>::getExactPoint(const uint32_t& point, T* coords) const {
+    size_t dimension = structure_.dimension_;
+    if (storage_ == Storage_t::MEMORY) {
+        copy(&exact_coords_[size_t(point)*dimension],
+             &exact_coords_[size_t(point)*dimension] + dimension, coords);
+        return;
+    }
+    lock_guard<mutex> lock(*exact_mutex_);
+    exact_stream_->seekg(size_t(point)*dimension*sizeof(T));
+    exact_stream_->read(reinterpret_cast<char*>(coords), dimension*sizeof(T));
+}
+
+template <typename T, typename Q>
+void QuantizedKdTree<T, Q>::getCandidates(const uint32_t& node, const T* query, T& best_upper,
+                                          vector<pair<T, uint32_t>>& candidates) const {
+    size_t dimension = structure_.dimension_;
+    const FlatKdNode<T>& flat_node = structure_.nodes_[node];
+    if (!structure_.bounds_.empty()) {
+        const T* box = &structure_.bounds_[size_t(node)*2*dimension];
+        T box_dist = T(0);
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            T excess = max(box[axis] - query[axis], max(query[axis] - box[dimension+axis], T(0)));
+            box_dist += excess*excess;
+        }
+        if (box_dist > best_upper)
+            return;
+    }
+
+    T lower, upper;
+    getCellBounds(flat_node.point, query, lower, upper);
+    best_upper = min(best_upper, upper);
+    if (lower <= best_upper)
+        candidates.push_back(make_pair(lower, flat_node.point));
+    if (flat_node.isLeaf())
+        return;
+
+    T plane_dist = query[flat_node.split_axis] - flat_node.split_position;
+    uint32_t near_child = (plane_dist < T(0)) ? flat_node.left_child : flat_node.right_child;
+    uint32_t far_child = (plane_dist < T(0)) ? flat_node.right_child : flat_node.left_child;
+    if (near_child != FlatKdTree<T>::null_node_)
+        getCandidates(near_child, query, best_upper, candidates);
+    if (far_child != FlatKdTree<T>::null_node_ && plane_dist*plane_dist <= best_upper)
+        getCandidates(far_child, query, best_upper, candidates);
+}
+
+template <typename T, typename Q>
+pair<size_t, T> QuantizedKdTree<T, Q>::findNearest(const Point<T>& query, size_t* reranked) const {
+    if (isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+
+    typename KdTree<T>::Metric_t metric = structure_.metric_;
+    vector<T> search_query = structure_.toSearchQuery(query);
+
+    T best_upper = numeric_limits<T>::max();
+    vector<pair<T, uint32_t>> candidates;
+    getCandidates(0, search_query.data(), best_upper, candidates);
+    sort(candidates.begin(), candidates.end());
+
+    // Rerank by exact distance until no remaining cell can be closer
+    size_t dimension = structure_.dimension_;
+    vector<T> exact(dimension);
+    uint32_t best_point = 0;
+    T best_dist = numeric_limits<T>::max();
+    size_t count = 0;
+    for (auto iter = candidates.begin(); iter != candidates.end(); ++iter) {
+        if (iter->first > best_upper || iter->first >= best_dist)
+            break;
+        getExactPoint(iter->second, exact.data());
+        ++count;
+        T distance = T(0);
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            T diff = exact[axis] - search_query[axis];
+            distance += diff*diff;
+        }
+        if (distance < best_dist) {
+            best_dist = distance;
+            best_point = iter->second;
+        }
+    }
+    if (reranked != nullptr)
+        *reranked = count;
+
+    return make_pair(structure_.ids_[best_point],
+                     KdTree<T>::transformScore(sqrt(best_dist), query, metric, structure_.max_norm_));
+}
+
+template <typename T, typename Q>
+void QuantizedKdTree<T, Q>::queryQuantizedKdTree(const QuantizedKdTree<T, Q>& tree,
+                                                 const vector<Point<T>*>& query_points) {
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = tree.findNearest(**iter);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T, typename Q>
+void QuantizedKdTree<T, Q>::queryQuantizedKdTree(const QuantizedKdTree<T, Q>& tree,
+                                                 const PointSet<T>& query_points) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t i = 0; i < query_points.size(); ++i) {
+        pair<size_t, T> nearest = tree.findNearest(query_points[i].toPoint());
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template class QuantizedKdTree<float, uint8_t>;
+template class QuantizedKdTree<float, uint16_t>;
+template class QuantizedKdTree<double, uint8_t>;
+template class QuantizedKdTree<double, uint16_t>;
+
+
+#endif /* KD_QUANTIZED_CPP_ */
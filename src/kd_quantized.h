@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#ifndef KD_QUANTIZED_H_
+#define KD_QUANTIZED_H_
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <stdint.h>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "kd_point_set.h"
+#include "kd_flat_tree.h"
+
+// Flat KD-tree whose Points are stored as Q-bit codes per axis (Q is
+// uint8_t or uint16_t). Each axis is quantized over its own min/range. A
+// search runs on the codes with conservative distance bounds, and the few
+// Points whose cells could hold the nearest neighbor are then reranked
+// against the full precision data, kept in memory or in a file.
+template <typename T=double, typename Q=uint8_t>
+class QuantizedKdTree {
+public:
+    // Where the full precision coordinates used for reranking live
+    enum class Storage_t {MEMORY, DISK};
+
+private:
+    FlatKdTree<T> structure_;       // Nodes, indexes and bounds, no coordinates
+    std::vector<Q> codes_;          // Row-major quantized coordinates
+    std::vector<T> offset_;         // Per-axis minimum
+    std::vector<T> scale_;          // Per-axis cell width
+    Storage_t storage_ = Storage_t::MEMORY;
+    std::vector<T> exact_coords_;   // Full precision coordinates (MEMORY)
+    std::string exact_file_;        // Full precision coordinates (DISK)
+    mutable std::shared_ptr<std::ifstream> exact_stream_;
+    mutable std::shared_ptr<std::mutex> exact_mutex_;
+
+    // Lower and upper bounds on the squared distance from a query to a
+    // stored Point, from the cell its codes describe
+    void getCellBounds(const uint32_t& point, const T* query, T& lower, T& upper) const;
+
+    // Full precision coordinates of a stored Point
+    void getExactPoint(const uint32_t& point, T* coords) const;
+
+    // Recursively collect Points whose cells may hold the nearest neighbor
+    void getCandidates(const uint32_t& node, const T* query, T& best_upper,
+                       std::vector<std::pair<T, uint32_t>>& candidates) const;
+
+public:
+    // Constructors/Destructor
+    QuantizedKdTree() = default;
+    ~QuantizedKdTree() = default;
+
+    // Quantize a flat KD-tree. With DISK storage the full precision
+    // coordinates are written to exact_file and read back when reranking.
+    static QuantizedKdTree<T, Q> quantize(const FlatKdTree<T>& tree,
+                                          const Storage_t& storage = Storage_t::MEMORY,
+                                          const std::string& exact_file = "tree_exact.bin");
+
+    // Member functions
+    bool isEmpty() const;
+    size_t getDimension() const;
+
+    // Bytes held in memory by the index
+    size_t getMemoryUsage() const;
+
+    // Find the nearest neighbor of a single query under the tree's metric.
+    // Returns {point index, score}; reranked receives the candidate count.
+    std::pair<size_t, T> findNearest(const Point<T>& query, size_t* reranked = nullptr) const;
+
+    // Query quantized KD tree for a set of points
+    static void queryQuantizedKdTree(const QuantizedKdTree<T, Q>& tree,
+                                     const std::vector<Point<T>*>& query_points);
+    static void queryQuantizedKdTree(const QuantizedKdTree<T, Q>& tree,
+                                     const PointSet<T>& query_points);
+};
+
+
+#include "kd_quantized.cpp"
+
+#endif /* KD_QUANTIZED_H_ */
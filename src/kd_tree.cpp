@@ -27,8 +27,16 @@
 #include <vector>
 #include <limits>
 #include <memory>
+#include <numeric>
+#include <cmath>
+#include <cassert>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include "file_handler.h"
 #include "kd_math.h"
+#include "kd_point_set.h"
 #include "kd_tree.h"
 #include <cereal/cereal.hpp>
 #include <cereal/archives/json.hpp>
@@ -40,24 +48,241 @@ using namespace std;
 template <typename T>
 typename KdTree<T>::SplitMethod_t KdTree<T>::split_method_ = SplitMethod_t::VARIANCE;
 
+// SET INSERTION BALANCE FACTOR HERE (0.5 < factor < 1)
+template <typename T>
+double KdTree<T>::balance_factor_ = 0.75;
+
+// SET ERASED FRACTION THAT TRIGGERS COMPACTION HERE
+template <typename T>
+double KdTree<T>::compaction_threshold_ = 0.25;
+
+// SET BOUNDING BOX STORAGE HERE
+template <typename T>
+bool KdTree<T>::tight_bounds_ = false;
+
+// SET MORTON ORDER PRESORT OF BUILD INPUT HERE
+template <typename T>
+bool KdTree<T>::morton_presort_ = false;
+
+// SET MORTON ORDER EXECUTION OF QUERY BATCHES HERE
+template <typename T>
+bool KdTree<T>::morton_query_order_ = false;
+
+// SET PCA ROTATION OF THE BUILD INPUT HERE
+template <typename T>
+bool KdTree<T>::pca_rotation_ = false;
+
+// SET SUBSET SIZE FOR RANGE-ONLY SPLIT STATISTICS HERE
+template <typename T>
+size_t KdTree<T>::range_stats_threshold_ = 256;
+
+// SET SAMPLED SPLIT SELECTION OF LARGE SUBSETS HERE
+template <typename T>
+size_t KdTree<T>::split_sample_size_ = 0;
+
+template <typename T>
+size_t KdTree<T>::split_sample_threshold_ = 65536;
+
+template <typename T>
+unsigned int KdTree<T>::split_sample_seed_ = 1;
+
+// SET PRESORTED BUILD HERE
+template <typename T>
+bool KdTree<T>::presorted_build_ = false;
+
+// SET LAZY BUILD HERE
+template <typename T>
+bool KdTree<T>::lazy_build_ = false;
+
+template <typename T>
+size_t KdTree<T>::lazy_subtree_size_ = 1024;
+
+// SET ARENA ALLOCATION OF BUILDS HERE
+template <typename T>
+bool KdTree<T>::arena_build_ = false;
+
+template <typename T>
+size_t KdTree<T>::arena_block_bytes_ = size_t(1) << 20;
+
+template <typename T>
+bool KdTree<T>::arena_huge_pages_ = false;
+
 template <typename T>
 KdTree<T>::KdTree(const shared_ptr<KdTreeNode<T>> root_node) : root_(root_node) {}
 
 template <typename T>
 KdTreeNode<T> KdTree<T>::getRootNode() const {
+    materialize();
     return *root_;
 }
 
 template <typename T>
 KdTree<T> KdTree<T>::getLeftSubtree() const {
+    materialize();
     return KdTree<T>(root_->left_child);
 }
 
 template <typename T>
 KdTree<T> KdTree<T>::getRightSubtree() const {
+    materialize();
     return KdTree<T>(root_->right_child);
 }
 
+template <typename T>
+bool KdTree<T>::isEmpty() const {
+    return root_ == nullptr;
+}
+
+template <typename T>
+void KdTree<T>::setCopyOnWrite(bool copy_on_write) {
+    copy_on_write_ = copy_on_write;
+}
+
+template <typename T>
+KdTree<T> KdTree<T>::clone() const {
+    materialize();
+    KdTree<T> copy(*this);
+    copy.root_ = cloneSubtree(root_);
+    return copy;
+}
+
+template <typename T>
+shared_ptr<KdTreeNode<T>> KdTree<T>::cloneSubtree(const shared_ptr<KdTreeNode<T>>& node) {
+    if (node == nullptr)
+        return nullptr;
+    shared_ptr<KdTreeNode<T>> copy = make_shared<KdTreeNode<T>>(*node);
+    copy->left_child = cloneSubtree(node->left_child);
+    copy->right_child = cloneSubtree(node->right_child);
+    return copy;
+}
+
+template <typename T>
+typename KdTree<T>::Metric_t KdTree<T>::getMetric() const {
+    return metric_;
+}
+
+template <typename T>
+T KdTree<T>::getMaxNorm() const {
+    return max_norm_;
+}
+
+template <typename T>
+size_t KdTree<T>::size() const {
+    return isEmpty() ? 0 : root_->size - root_->deleted_count;
+}
+
+template <typename T>
+vector<Point<T>> KdTree<T>::getPoints() const {
+    materialize();
+    vector<Point<T>> points;
+    points.reserve(size());
+    collectPoints(root_, points);
+    if (rotation_.empty())
+        return points;
+
+    // Rotate back with the transpose; a lifted INNER_PRODUCT coordinate
+    // follows the rotated ones and is kept as is
+    size_t dimension = variances_.size();
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        vector<T> unrotated = iter->getPointVector();
+        for (size_t col = 0; col < dimension; ++col) {
+            T sum = T(0);
+            for (size_t row = 0; row < dimension; ++row)
+                sum += rotation_[row*dimension + col]*(*iter)[row];
+            unrotated[col] = sum;
+        }
+        *iter = Point<T>(unrotated, iter->getIndex());
+    }
+    return points;
+}
+
+template <typename T>
+const vector<T>& KdTree<T>::getRotation() const {
+    return rotation_;
+}
+
+template <typename T>
+vector<T> KdTree<T>::getVarianceCaptured() const {
+    T total = accumulate(variances_.begin(), variances_.end(), T(0));
+    vector<T> captured(variances_.size(), T(0));
+    for (size_t axis = 0; axis < variances_.size() && total > T(0); ++axis)
+        captured[axis] = variances_[axis]/total;
+    return captured;
+}
+
+template <typename T>
+Point<T> KdTree<T>::toSearchSpace(const Point<T>& pt, bool is_query) const {
+    if (!rotation_.empty())
+        return transformPoint(rotatePoint(rotation_, pt), metric_, max_norm_, is_query);
+    return transformPoint(pt, metric_, max_norm_, is_query);
+}
+
+template <typename T>
+T KdTree<T>::toScore(const T& distance, const Point<T>& query) const {
+    return transformScore(distance, query, metric_, max_norm_);
+}
+
+template <typename T>
+Point<T> KdTree<T>::transformPoint(const Point<T>& pt, const Metric_t& metric,
+                                   const T& max_norm, bool is_query) {
+    if (metric == Metric_t::EUCLIDEAN)
+        return pt;
+    vector<T> search_coords;
+    search_coords.reserve(pt.getDimension() + 1);
+    appendSearchCoords(pt.begin(), pt.getDimension(), metric, max_norm, is_query, search_coords);
+    return Point<T>(search_coords, pt.getIndex());
+}
+
+template <typename T>
+void KdTree<T>::appendSearchCoords(const T* coords, const size_t& dimension, const Metric_t& metric,
+                                   const T& max_norm, bool is_query, vector<T>& search_coords) {
+    T norm = (metric == Metric_t::EUCLIDEAN) ? T(0)
+             : sqrt(inner_product(coords, coords + dimension, coords, T(0.0)));
+    switch (metric) {
+    case Metric_t::COSINE :
+        // Zero vectors are kept unchanged, as by normalize()
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            search_coords.push_back((norm == T(0.0)) ? coords[axis] : coords[axis] / norm);
+        }
+        return;
+
+    case Metric_t::INNER_PRODUCT : {
+        // Data points are lifted onto a sphere of radius max_norm so that
+        // |q - x|^2 = |q|^2 + max_norm^2 - 2<q,x>. Queries get a zero coordinate.
+        search_coords.insert(search_coords.end(), coords, coords + dimension);
+        T extra = T(0);
+        if (!is_query) {
+            T residual = max_norm*max_norm - norm*norm;
+            extra = (residual > T(0)) ? sqrt(residual) : T(0);
+        }
+        search_coords.push_back(extra);
+        return;
+    }
+
+    case Metric_t::EUCLIDEAN :
+        break;
+    }
+    search_coords.insert(search_coords.end(), coords, coords + dimension);
+}
+
+template <typename T>
+T KdTree<T>::transformScore(const T& distance, const Point<T>& query,
+                            const Metric_t& metric, const T& max_norm) {
+    switch (metric) {
+    case Metric_t::COSINE :
+        return T(1) - distance*distance/T(2);
+
+    case Metric_t::INNER_PRODUCT : {
+        T norm = getNorm(query);
+        return (norm*norm + max_norm*max_norm - distance*distance)/T(2);
+    }
+
+    case Metric_t::EUCLIDEAN :
+        break;
+    }
+    return distance;
+}
+
 // Choose splitting axis depending on policy
 template <typename T>
 size_t KdTree<T>::getSplitAxis(const vector<Point<T>>& distro_params,
@@ -90,114 +315,750 @@ template <typename T>
 Point<T> KdTree<T>::getPivot(const vector<Point<T>*>& input_points, const size_t& split_axis,
                                                         const T& split_position) {
 
-    Point<T> medianNode = **input_points.begin();
+    auto median_iter = input_points.begin();
     T distToMedian = numeric_limits<T>::max();
     for (auto iter = input_points.begin(); iter != input_points.end(); ++iter) {
         if (abs((**iter)[split_axis] - split_position) < distToMedian) {
-            medianNode = **iter;
-            distToMedian = (**iter)[split_axis] - split_position;
+            median_iter = iter;
+            distToMedian = abs((**iter)[split_axis] - split_position);
+        }
+    }
+    return **median_iter;
+}
+
+template <typename T>
+shared_ptr<KdTreeNode<T>> KdTree<T>::treeBuild(const vector<Point<T>*>& input_points,
+                                               const size_t depth,
+                                               const shared_ptr<Arena>& arena) {
+    if (!presorted_build_ || input_points.size() < 2)
+        return KdTree<T>::treeBuild(input_points, depth, vector<T>(), nullptr, arena);
+
+    // Order point positions along every axis, ties by position. Sorting
+    // (coordinate, position) pairs keeps the comparisons in contiguous memory.
+    size_t dimension = input_points[0]->getDimension();
+    vector<vector<size_t>> sorted(dimension, vector<size_t>(input_points.size()));
+    vector<pair<T, size_t>> keys(input_points.size());
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        for (size_t i = 0; i < input_points.size(); ++i) {
+            keys[i] = make_pair((*input_points[i])[axis], i);
         }
+        sort(keys.begin(), keys.end());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            sorted[axis][i] = keys[i].second;
+        }
+    }
+    vector<size_t> buffer(input_points.size());
+    vector<char> side(input_points.size());
+    return KdTree<T>::presortedBuild(input_points, sorted, buffer, side, 0,
+                                     input_points.size(), depth, arena);
+}
+
+template <typename T>
+shared_ptr<KdTreeNode<T>> KdTree<T>::presortedBuild(const vector<Point<T>*>& input_points,
+                                                    vector<vector<size_t>>& sorted,
+                                                    vector<size_t>& buffer, vector<char>& side,
+                                                    const size_t& begin, const size_t& end,
+                                                    const size_t depth,
+                                                    const shared_ptr<Arena>& arena) {
+    if (begin == end)
+        return nullptr;
+
+    size_t dimension = sorted.size();
+    size_t count = end - begin;
+    shared_ptr<KdTreeNode<T>> root = KdTree<T>::makeNode(depth, arena);
+    root->size = count;
+    if (tight_bounds_) {
+        root->bounds.resize(2*dimension);
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            root->bounds[axis] = (*input_points[sorted[axis][begin]])[axis];
+            root->bounds[dimension+axis] = (*input_points[sorted[axis][end-1]])[axis];
+        }
+    }
+    if (count == 1) {
+        root->point = Point<T>(*input_points[sorted[0][begin]], arena.get());
+        return root;
+    }
+
+    // Ranges are read off the ends of the sorted arrays; VARIANCE needs a
+    // pass over the points, at every subset size as in treeBuild
+    if (split_method_ == SplitMethod_t::VARIANCE) {
+        vector<Point<T>*> subset;
+        subset.reserve(count);
+        for (size_t i = begin; i < end; ++i) {
+            subset.push_back(input_points[sorted[0][i]]);
+        }
+        root->split_axis = KdTree<T>::getSplitAxis(getDistributionParams(subset), depth);
+    }
+    else if (split_method_ == SplitMethod_t::CYCLE) {
+        root->split_axis = depth % dimension;
+    }
+    else {
+        T widest = T(-1);
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            T range = (*input_points[sorted[axis][end-1]])[axis]
+                      - (*input_points[sorted[axis][begin]])[axis];
+            if (range > widest) {
+                widest = range;
+                root->split_axis = axis;
+            }
+        }
+    }
+
+    // The pivot is the first point holding the median coordinate, so that
+    // every point before it is strictly smaller and equal values go right
+    size_t axis = root->split_axis;
+    const vector<size_t>& order = sorted[axis];
+    size_t median = begin + count/2;
+    root->split_position = (*input_points[order[median]])[axis];
+    while (median > begin && (*input_points[order[median-1]])[axis] == root->split_position) {
+        --median;
     }
-    return medianNode;
+    size_t pivot = order[median];
+    root->point = Point<T>(*input_points[pivot], arena.get());
+
+    for (size_t i = begin; i < median; ++i) {
+        side[order[i]] = 0;
+    }
+    for (size_t i = median+1; i < end; ++i) {
+        side[order[i]] = 1;
+    }
+    side[pivot] = 2;
+
+    // Stable partition of every axis into [left][right][pivot]
+    size_t l_count = median - begin;
+    for (size_t sort_axis = 0; sort_axis < dimension; ++sort_axis) {
+        vector<size_t>& indices = sorted[sort_axis];
+        copy(indices.begin()+begin, indices.begin()+end, buffer.begin()+begin);
+        size_t left = begin;
+        size_t right = begin + l_count;
+        for (size_t i = begin; i < end; ++i) {
+            size_t index = buffer[i];
+            if (side[index] == 0)
+                indices[left++] = index;
+            else if (side[index] == 1)
+                indices[right++] = index;
+        }
+        indices[end-1] = pivot;
+    }
+
+    root->left_child = KdTree<T>::presortedBuild(input_points, sorted, buffer, side,
+                                                 begin, begin+l_count, depth+1, arena);
+    root->right_child = KdTree<T>::presortedBuild(input_points, sorted, buffer, side,
+                                                  begin+l_count, end-1, depth+1, arena);
+    return root;
 }
 
 template <typename T>
 shared_ptr<KdTreeNode<T>> KdTree<T>::treeBuild(const vector<Point<T>*>& input_points,
-                                               const size_t depth) {
+                                               const size_t depth, const vector<T>& cell,
+                                               const shared_ptr<vector<Point<T>>>& lazy_points,
+                                               const shared_ptr<Arena>& arena) {
 
     if (input_points.size() == 0) {
         return nullptr;
     }
     if (input_points.size() == 1) {
-        shared_ptr<KdTreeNode<T>> leaf = make_shared<KdTreeNode<T>>(depth);
-        leaf->point = *input_points[0];
+        shared_ptr<KdTreeNode<T>> leaf = KdTree<T>::makeNode(depth, arena);
+        leaf->point = Point<T>(*input_points[0], arena.get());
+        leaf->size = 1;
+        if (tight_bounds_) {
+            leaf->bounds = leaf->point.getPointVector();
+            leaf->bounds.insert(leaf->bounds.end(), leaf->point.begin(), leaf->point.end());
+        }
         return leaf;
     }
 
-    shared_ptr<KdTreeNode<T>> root = make_shared<KdTreeNode<T>>();
-    root->depth = depth;
+    shared_ptr<KdTreeNode<T>> root = KdTree<T>::makeNode(depth, arena);
+    size_t dimension = input_points[0]->getDimension();
 
-    // Dimension-wise parameters are {min, max, range, mean, variance};
-    vector<Point<T>> distro_params = getDistributionParams(input_points);
+    // Cell of this subtree as {min..., max...}, passed on to the children
+    vector<T> node_cell;
+    if (split_sample_size_ > 0 && input_points.size() > split_sample_threshold_) {
+        // The first point's index tells apart siblings of equal size
+        seed_seq seed{split_sample_seed_, uint32_t(depth), uint32_t(input_points.size()),
+                      uint32_t(input_points[0]->getIndex())};
+        mt19937 rng(seed);
+        uniform_int_distribution<size_t> pick(0, input_points.size()-1);
+        vector<Point<T>*> sample(split_sample_size_);
+        for (auto iter = sample.begin(); iter != sample.end(); ++iter) {
+            *iter = input_points[pick(rng)];
+        }
+
+        vector<Point<T>> distro_params = getDistributionParams(sample);
+        root->split_axis = KdTree<T>::getSplitAxis(distro_params, depth);
+        root->split_position = getApproxMedian(sample, root->split_axis,
+                                               distro_params[3], distro_params[4]);
 
-    root->split_axis = KdTree<T>::getSplitAxis(distro_params, depth);
-    root->split_position =  getApproxMedian(input_points, root->split_axis,
-                                           distro_params[3], distro_params[4]);
-    root->point = KdTree<T>::getPivot(input_points, root->split_axis, root->split_position);
+        // The sample's ranges may miss points, so the cell is either
+        // computed or inherited
+        if (tight_bounds_)
+            node_cell = getBoundingBox(input_points);
+        else
+            node_cell = cell;
+    }
+    else if (input_points.size() > range_stats_threshold_) {
+        // Dimension-wise parameters are {min, max, range, mean, variance};
+        vector<Point<T>> distro_params = getDistributionParams(input_points);
+        node_cell = distro_params[0].getPointVector();
+        node_cell.insert(node_cell.end(), distro_params[1].begin(), distro_params[1].end());
 
-    // Split data into halfspaces
+        root->split_axis = KdTree<T>::getSplitAxis(distro_params, depth);
+        root->split_position =  getApproxMedian(input_points, root->split_axis,
+                                               distro_params[3], distro_params[4]);
+    }
+    else {
+        // The inherited cell is clipped at every split and can be much wider
+        // than the points, so VARIANCE and RANGE use the subset's own values
+        if (split_method_ == SplitMethod_t::VARIANCE) {
+            vector<Point<T>> distro_params = getDistributionParams(input_points);
+            node_cell = distro_params[0].getPointVector();
+            node_cell.insert(node_cell.end(), distro_params[1].begin(), distro_params[1].end());
+            root->split_axis = KdTree<T>::getSplitAxis(distro_params, depth);
+        }
+        else if (split_method_ == SplitMethod_t::RANGE) {
+            node_cell = getBoundingBox(input_points);
+            root->split_axis = 0;
+            for (size_t axis = 1; axis < dimension; ++axis) {
+                if (node_cell[dimension+axis] - node_cell[axis] >
+                    node_cell[dimension+root->split_axis] - node_cell[root->split_axis])
+                    root->split_axis = axis;
+            }
+        }
+        else {
+            node_cell = tight_bounds_ ? getBoundingBox(input_points) : cell;
+            root->split_axis = depth % dimension;
+        }
+        root->split_position = getExactMedian(input_points, root->split_axis);
+    }
+
+    if (tight_bounds_)
+        root->bounds = node_cell;
+    root->point = Point<T>(KdTree<T>::getPivot(input_points, root->split_axis, root->split_position),
+                           arena.get());
+
+    // Split data into halfspaces, leaving out the pivot stored in this node
     vector<Point<T>*> l_subset, r_subset;
-    for (auto iter = input_points.begin()+1; iter != input_points.end(); ++iter) {
-        vector<T> pt_vect = (*iter)->getPointVector();
-        if (pt_vect[root->split_axis] < root->split_position)
+    bool pivot_skipped = false;
+    for (auto iter = input_points.begin(); iter != input_points.end(); ++iter) {
+        if (!pivot_skipped && (*iter)->getIndex() == root->point.getIndex()
+            && **iter == root->point) {
+            pivot_skipped = true;
+            continue;
+        }
+        if ((**iter)[root->split_axis] < root->split_position)
             l_subset.push_back(*iter);
         else
             r_subset.push_back(*iter);
     }
 
-    root->left_child = KdTree<T>::treeBuild(l_subset, depth+1);
-    root->right_child = KdTree<T>::treeBuild(r_subset, depth+1);
+    // Child cells are this cell cut at the splitting plane
+    vector<T> l_cell, r_cell;
+    if (!node_cell.empty()) {
+        size_t axis = root->split_axis;
+        l_cell = node_cell;
+        l_cell[dimension+axis] = min(l_cell[dimension+axis], root->split_position);
+        r_cell.swap(node_cell);
+        r_cell[axis] = max(r_cell[axis], root->split_position);
+    }
+
+    root->size = input_points.size();
+    if (lazy_points != nullptr && input_points.size() > lazy_subtree_size_) {
+        shared_ptr<PendingSubtree<T>> pending = make_shared<PendingSubtree<T>>();
+        pending->build_points = lazy_points;
+        pending->arena = arena;
+        pending->left_points.swap(l_subset);
+        pending->right_points.swap(r_subset);
+        pending->left_cell.swap(l_cell);
+        pending->right_cell.swap(r_cell);
+        root->pending = pending;
+        return root;
+    }
+
+    root->left_child = KdTree<T>::treeBuild(l_subset, depth+1, l_cell, lazy_points, arena);
+    root->right_child = KdTree<T>::treeBuild(r_subset, depth+1, r_cell, lazy_points, arena);
 
     return root;
 }
 
 template <typename T>
-KdTree<T> KdTree<T>::buildKdTree(const vector<Point<T>*>& input_points) {
-    KdTree<T> tree(treeBuild(input_points,0));
+shared_ptr<KdTreeNode<T>> KdTree<T>::makeNode(const size_t depth, const shared_ptr<Arena>& arena) {
+    if (arena == nullptr)
+        return make_shared<KdTreeNode<T>>(depth);
+    return allocate_shared<KdTreeNode<T>>(SharedArenaAllocator<KdTreeNode<T>>(arena), depth);
+}
+
+template <typename T>
+void KdTree<T>::expandNode(const KdTreeNode<T>& node) {
+    if (node.pending == nullptr || node.pending->built.load(memory_order_acquire))
+        return;
+    PendingSubtree<T>& pending = *node.pending;
+    lock_guard<mutex> lock(pending.mutex);
+    if (pending.built.load(memory_order_relaxed))
+        return;
+
+    // Searches may expand other nodes at the same time, so the children get
+    // an arena of their own, sized for the nodes built now. Children that
+    // are still pending are a single node.
+    shared_ptr<Arena> arena;
+    if (pending.arena != nullptr) {
+        size_t node_bytes = sizeof(KdTreeNode<T>) + 64 + 3*node.point.getDimension()*sizeof(T);
+        size_t child_nodes = 0;
+        for (size_t count : {pending.left_points.size(), pending.right_points.size()})
+            child_nodes += (count > lazy_subtree_size_) ? 1 : count;
+        arena = make_shared<Arena>(min(pending.arena->getBlockBytes(), child_nodes*node_bytes));
+    }
+
+    // Searches only read the children after seeing built set, so they can
+    // be filled in place
+    KdTreeNode<T>& target = const_cast<KdTreeNode<T>&>(node);
+    target.left_child = KdTree<T>::treeBuild(pending.left_points, node.depth+1,
+                                             pending.left_cell, pending.build_points, arena);
+    target.right_child = KdTree<T>::treeBuild(pending.right_points, node.depth+1,
+                                              pending.right_cell, pending.build_points, arena);
+    vector<Point<T>*>().swap(pending.left_points);
+    vector<Point<T>*>().swap(pending.right_points);
+    vector<T>().swap(pending.left_cell);
+    vector<T>().swap(pending.right_cell);
+    pending.build_points.reset();
+    pending.arena.reset();
+    pending.built.store(true, memory_order_release);
+}
+
+template <typename T>
+void KdTree<T>::expandSubtree(const shared_ptr<KdTreeNode<T>>& node) {
+    if (node == nullptr)
+        return;
+    expandNode(*node);
+    expandSubtree(node->left_child);
+    expandSubtree(node->right_child);
+}
+
+template <typename T>
+void KdTree<T>::materialize() const {
+    if (!lazy_points_.expired())
+        expandSubtree(root_);
+}
+
+template <typename T>
+void KdTree<T>::collectPoints(const shared_ptr<KdTreeNode<T>>& node, vector<Point<T>>& points) {
+    if (node == nullptr || node->deleted_count == node->size)
+        return;
+    if (!node->deleted)
+        points.push_back(node->point);
+    collectPoints(node->left_child, points);
+    collectPoints(node->right_child, points);
+}
+
+template <typename T>
+void KdTree<T>::insert(const Point<T>& point) {
+    materialize();
+    // A new largest norm invalidates the lifting of every stored point.
+    // The tree is rebuilt in its own rotation, whatever the build policies
+    // are now, and on the heap like other nodes added after the build.
+    if (metric_ == Metric_t::INNER_PRODUCT && getNorm(point) > max_norm_) {
+        vector<Point<T>> points = getPoints();
+        for (auto iter = points.begin(); iter != points.end(); ++iter) {
+            vector<T> lifted = iter->getPointVector();
+            lifted.pop_back();
+            *iter = Point<T>(lifted, iter->getIndex());
+        }
+        points.push_back(point);
+        max_norm_ = getNorm(point);
+        vector<Point<T>*> search_ptrs;
+        search_ptrs.reserve(points.size());
+        for (auto iter = points.begin(); iter != points.end(); ++iter) {
+            *iter = toSearchSpace(*iter);
+            search_ptrs.push_back(&(*iter));
+        }
+        root_ = treeBuild(search_ptrs, 0);
+        return;
+    }
+
+    Point<T> pt = toSearchSpace(point);
+    if (root_ == nullptr) {
+        vector<Point<T>*> single(1, &pt);
+        root_ = treeBuild(single, 0);
+        return;
+    }
+    assert(pt.getDimension() == root_->point.getDimension());
+
+    // Descend to an empty child slot, growing subtree sizes along the way
+    vector<shared_ptr<KdTreeNode<T>>*> path;
+    shared_ptr<KdTreeNode<T>>* slot = &root_;
+    while (*slot != nullptr) {
+        if (copy_on_write_)
+            *slot = make_shared<KdTreeNode<T>>(**slot);
+        path.push_back(slot);
+        KdTreeNode<T>& node = **slot;
+        if (node.isLeaf()) {
+            node.split_axis = node.depth % pt.getDimension();
+            node.split_position = node.point[node.split_axis];
+        }
+        ++node.size;
+        if (!node.bounds.empty()) {
+            size_t dimension = pt.getDimension();
+            for (size_t axis = 0; axis < dimension; ++axis) {
+                node.bounds[axis] = min(node.bounds[axis], pt[axis]);
+                node.bounds[dimension+axis] = max(node.bounds[dimension+axis], pt[axis]);
+            }
+        }
+        slot = (pt[node.split_axis] < node.split_position) ? &node.left_child
+                                                           : &node.right_child;
+    }
+    vector<Point<T>*> single(1, &pt);
+    *slot = treeBuild(single, path.size());
+
+    // Rebuild the highest unbalanced ancestor once the new leaf is too deep
+    double max_depth = log(double(root_->size)) / log(1.0/balance_factor_);
+    if (double(path.size()) <= max_depth)
+        return;
+
+    size_t child_size = 1;
+    for (size_t level = path.size(); level-- > 0;) {
+        if (double(child_size) > balance_factor_*double((*path[level])->size)) {
+            rebuildSubtree(path, level);
+            break;
+        }
+        child_size = (*path[level])->size;
+    }
+}
+
+template <typename T>
+void KdTree<T>::rebuildSubtree(const vector<shared_ptr<KdTreeNode<T>>*>& path,
+                               const size_t& level) {
+    shared_ptr<KdTreeNode<T>>& slot = *path[level];
+    size_t old_size = slot->size;
+    size_t old_deleted = slot->deleted_count;
+
+    vector<Point<T>> points;
+    collectPoints(slot, points);
+    vector<Point<T>*> point_ptrs;
+    point_ptrs.reserve(points.size());
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        point_ptrs.push_back(&(*iter));
+    }
+
+    // The replacement is built out of place. The store below is a plain
+    // shared_ptr assignment that frees the old subtree at once, so readers
+    // may only run concurrently on copy-on-write versions published through
+    // ConcurrentKdTree, which never share this slot.
+    shared_ptr<KdTreeNode<T>> rebuilt = treeBuild(point_ptrs, slot->depth);
+    slot = rebuilt;
+
+    size_t removed = old_size - points.size();
+    for (size_t i = 0; i < level; ++i) {
+        (*path[i])->size -= removed;
+        (*path[i])->deleted_count -= old_deleted;
+    }
+}
+
+template <typename T>
+void KdTree<T>::detachPath(vector<shared_ptr<KdTreeNode<T>>*>& path) {
+    for (size_t level = 0; level < path.size(); ++level) {
+        shared_ptr<KdTreeNode<T>> shared_node = *path[level];
+        *path[level] = make_shared<KdTreeNode<T>>(*shared_node);
+        if (level+1 < path.size()) {
+            path[level+1] = (path[level+1] == &shared_node->left_child)
+                            ? &(*path[level])->left_child : &(*path[level])->right_child;
+        }
+    }
+}
+
+template <typename T>
+void KdTree<T>::eraseAtPath(vector<shared_ptr<KdTreeNode<T>>*>& path) {
+    if (copy_on_write_)
+        detachPath(path);
+    (*path.back())->deleted = true;
+    for (auto iter = path.begin(); iter != path.end(); ++iter) {
+        ++(**iter)->deleted_count;
+    }
+
+    // Compact the highest subtree on the path that crossed the threshold
+    for (size_t level = 0; level < path.size(); ++level) {
+        const KdTreeNode<T>& node = **path[level];
+        if (double(node.deleted_count) > compaction_threshold_*double(node.size)) {
+            rebuildSubtree(path, level);
+            break;
+        }
+    }
+}
+
+template <typename T>
+bool KdTree<T>::findPath(shared_ptr<KdTreeNode<T>>& slot, const size_t& index,
+                         vector<shared_ptr<KdTreeNode<T>>*>& path) {
+    if (slot == nullptr || slot->deleted_count == slot->size)
+        return false;
+    path.push_back(&slot);
+    if ((!slot->deleted && slot->point.getIndex() == index)
+        || findPath(slot->left_child, index, path)
+        || findPath(slot->right_child, index, path))
+        return true;
+    path.pop_back();
+    return false;
+}
+
+template <typename T>
+bool KdTree<T>::erase(const Point<T>& point) {
+    materialize();
+    Point<T> pt = toSearchSpace(point);
+
+    // Points equal to a split position were placed in the right subtree
+    vector<shared_ptr<KdTreeNode<T>>*> path;
+    shared_ptr<KdTreeNode<T>>* slot = &root_;
+    while (*slot != nullptr) {
+        path.push_back(slot);
+        KdTreeNode<T>& node = **slot;
+        if (!node.deleted && node.point.getIndex() == pt.getIndex() && node.point == pt) {
+            eraseAtPath(path);
+            return true;
+        }
+        slot = (pt[node.split_axis] < node.split_position) ? &node.left_child
+                                                           : &node.right_child;
+    }
+    return false;
+}
+
+template <typename T>
+bool KdTree<T>::erase(const size_t& index) {
+    materialize();
+    vector<shared_ptr<KdTreeNode<T>>*> path;
+    if (!findPath(root_, index, path))
+        return false;
+    eraseAtPath(path);
+    return true;
+}
+
+template <typename T>
+void KdTree<T>::compact() {
+    materialize();
+    if (root_ == nullptr)
+        return;
+    vector<shared_ptr<KdTreeNode<T>>*> path(1, &root_);
+    rebuildSubtree(path, 0);
+}
+
+template <typename T>
+KdTree<T> KdTree<T>::buildKdTree(const vector<Point<T>*>& input_points,
+                                 const Metric_t& metric) {
+    shared_ptr<Arena> arena;
+    if (arena_build_)
+        arena = make_shared<Arena>(arena_block_bytes_, arena_huge_pages_);
+    if (metric == Metric_t::EUCLIDEAN && !morton_presort_ && !pca_rotation_ && !lazy_build_) {
+        KdTree<T> tree(treeBuild(input_points, 0, arena));
+        return tree;
+    }
+
+    KdTree<T> tree;
+    tree.metric_ = metric;
+    if (pca_rotation_ && !input_points.empty())
+        tree.rotation_ = getPrincipalAxes(input_points, tree.variances_);
+    if (metric == Metric_t::INNER_PRODUCT) {
+        for (auto iter = input_points.begin(); iter != input_points.end(); ++iter) {
+            tree.max_norm_ = max(tree.max_norm_, getNorm(**iter));
+        }
+    }
+
+    // Build on transformed copies of the input, laid out along the
+    // Morton curve when requested so that every subtree's points sit close
+    // together in memory. A lazy build keeps the copies for its pending nodes.
+    vector<Point<T>*> ordered_points = input_points;
+    if (morton_presort_ && !ordered_points.empty())
+        sortByMortonCode(ordered_points);
+    shared_ptr<vector<Point<T>>> transformed = make_shared<vector<Point<T>>>();
+    transformed->reserve(ordered_points.size());
+    for (auto iter = ordered_points.begin(); iter != ordered_points.end(); ++iter) {
+        transformed->push_back(tree.toSearchSpace(**iter));
+    }
+    vector<Point<T>*> transformed_ptrs;
+    transformed_ptrs.reserve(transformed->size());
+    for (auto iter = transformed->begin(); iter != transformed->end(); ++iter) {
+        transformed_ptrs.push_back(&(*iter));
+    }
+    if (lazy_build_) {
+        tree.root_ = treeBuild(transformed_ptrs, 0, vector<T>(), transformed, arena);
+        tree.lazy_points_ = transformed;
+    }
+    else {
+        tree.root_ = treeBuild(transformed_ptrs, 0, arena);
+    }
     return tree;
 }
 
+template <typename T>
+KdTree<T> KdTree<T>::buildKdTree(const PointSet<T>& input_points, const Metric_t& metric) {
+    // Nodes keep their own copies, so the input Points are only temporary
+    Arena arena;
+    return buildKdTree(input_points.getPointers(arena), metric);
+}
+
 template <typename T>
 void KdTree<T>::queryKdTree(const KdTree<T>& tree, const vector<Point<T>*>& query_points) {
-    vector<size_t> pointId;
-    pointId.reserve(query_points.size());
-    vector<T> dist;
-    dist.reserve(query_points.size());
-    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
-        shared_ptr<KdTreeNode<T>> bestNodePtr = make_shared<KdTreeNode<T>>();
-        shared_ptr<T> bestDistPtr = make_shared<T>(numeric_limits<T>::max());
-        KdTree<T>::getNearestNeighbor(tree.getRootNode(), **iter, bestNodePtr, bestDistPtr);
-        pointId.push_back((bestNodePtr->point).getIndex());
-        dist.push_back(*bestDistPtr);
+    vector<size_t> order;
+    if (morton_query_order_) {
+        order = getMortonOrder(query_points);
+    }
+    else {
+        order.resize(query_points.size());
+        iota(order.begin(), order.end(), size_t(0));
+    }
+
+    vector<size_t> pointId(query_points.size());
+    vector<T> dist(query_points.size());
+    for (auto iter = order.begin(); iter != order.end(); ++iter) {
+        pair<size_t, T> nearest = KdTree<T>::findNearest(tree, *query_points[*iter]);
+        pointId[*iter] = nearest.first;
+        dist[*iter] = nearest.second;
     }
 
     FileHandler<T>::csvWriteNnResults(pointId, dist);
 }
 
+template <typename T>
+void KdTree<T>::queryKdTree(const KdTree<T>& tree, const PointSet<T>& query_points) {
+    // Queries are read from the set's buffer, one Point at a time
+    vector<size_t> order;
+    if (morton_query_order_) {
+        order = getMortonOrder(query_points.data(), query_points.size(), query_points.getDimension());
+    }
+    else {
+        order.resize(query_points.size());
+        iota(order.begin(), order.end(), size_t(0));
+    }
+
+    vector<size_t> pointId(query_points.size());
+    vector<T> dist(query_points.size());
+    for (auto iter = order.begin(); iter != order.end(); ++iter) {
+        pair<size_t, T> nearest = KdTree<T>::findNearest(tree, query_points[*iter].toPoint());
+        pointId[*iter] = nearest.first;
+        dist[*iter] = nearest.second;
+    }
+
+    FileHandler<T>::csvWriteNnResults(pointId, dist);
+}
+
+template <typename T>
+pair<size_t, T> KdTree<T>::findNearest(const KdTree<T>& tree, const Point<T>& query) {
+    shared_ptr<KdTreeNode<T>> bestNodePtr = make_shared<KdTreeNode<T>>();
+    shared_ptr<T> bestDistPtr = make_shared<T>(numeric_limits<T>::max());
+    if (tree.isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+    if (tree.metric_ == Metric_t::EUCLIDEAN && tree.rotation_.empty()) {
+        KdTree<T>::getNearestNeighbor(*tree.root_, query, bestNodePtr, bestDistPtr);
+    }
+    else {
+        KdTree<T>::getNearestNeighbor(*tree.root_, tree.toSearchSpace(query, true),
+                                      bestNodePtr, bestDistPtr);
+    }
+    return make_pair((bestNodePtr->point).getIndex(), tree.toScore(*bestDistPtr, query));
+}
+
+template <typename T>
+pair<size_t, T> KdTree<T>::findNearest(const KdTree<T>& tree, const Point<T>& query,
+                                      Point<T>& hint, const T& upper_bound) {
+    shared_ptr<KdTreeNode<T>> bestNodePtr = make_shared<KdTreeNode<T>>();
+    shared_ptr<T> bestDistPtr = make_shared<T>(upper_bound);
+    if (tree.isEmpty())
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+    Point<T> search_query = tree.toSearchSpace(query, true);
+
+    // Path from the root towards the hint
+    vector<const KdTreeNode<T>*> path;
+    if (hint.getDimension() > 0) {
+        const KdTreeNode<T>* node = tree.root_.get();
+        while (node != nullptr) {
+            path.push_back(node);
+            if (node->point.getIndex() == hint.getIndex() && node->point == hint)
+                break;
+            expandNode(*node);
+            node = (hint[node->split_axis] < node->split_position) ? node->left_child.get()
+                                                                   : node->right_child.get();
+        }
+    }
+
+    if (path.empty()) {
+        KdTree<T>::getNearestNeighbor(*tree.root_, search_query, bestNodePtr, bestDistPtr);
+    }
+    else {
+        KdTree<T>::getNearestNeighbor(*path.back(), search_query, bestNodePtr, bestDistPtr);
+        for (size_t level = path.size()-1; level-- > 0;) {
+            const KdTreeNode<T>& node = *path[level];
+            if (!node.deleted) {
+                T distance = getDistance(node.point, search_query);
+                if (distance < *bestDistPtr) {
+                    *bestNodePtr = node;
+                    *bestDistPtr = distance;
+                }
+            }
+            bool from_left = (node.left_child.get() == path[level+1]);
+            const shared_ptr<KdTreeNode<T>>& sibling = from_left ? node.right_child : node.left_child;
+            T plane_dist = search_query[node.split_axis] - node.split_position;
+            bool sibling_near = from_left ? (plane_dist >= T(0)) : (plane_dist < T(0));
+            if (sibling != nullptr && (sibling_near || abs(plane_dist) < *bestDistPtr)) {
+                KdTree<T>::getNearestNeighbor(*sibling, search_query, bestNodePtr, bestDistPtr);
+            }
+        }
+    }
+
+    if (bestNodePtr->point.getDimension() == 0)
+        return make_pair(numeric_limits<size_t>::max(), numeric_limits<T>::max());
+    hint = bestNodePtr->point;
+    return make_pair((bestNodePtr->point).getIndex(), tree.toScore(*bestDistPtr, query));
+}
+
+template <typename T>
+T KdTree<T>::getBoxDistance(const KdTreeNode<T>& node, const Point<T>& query) {
+    if (node.bounds.empty())
+        return T(0);
+    size_t dimension = query.getDimension();
+    T sum = T(0);
+    for (size_t axis = 0; axis < dimension; ++axis) {
+        T excess = T(0);
+        if (query[axis] < node.bounds[axis])
+            excess = node.bounds[axis] - query[axis];
+        else if (query[axis] > node.bounds[dimension+axis])
+            excess = query[axis] - node.bounds[dimension+axis];
+        sum += excess*excess;
+    }
+    return sqrt(sum);
+}
+
 template <typename T>
 void KdTree<T>::getNearestNeighbor(const KdTreeNode<T>& node,
                                    const Point<T>& query,
                                    const shared_ptr<KdTreeNode<T>>& bestNode,
                                    const shared_ptr<T>& bestDist) {
 
-    T distance = getDistance(node.point, query);
-    if (distance < *bestDist) {
-        *bestNode = node;
-        *bestDist = distance;
+    if (node.deleted_count == node.size)
+        return;
+    if (!node.bounds.empty() && getBoxDistance(node, query) >= *bestDist)
+        return;
+    expandNode(node);
+    if (!node.deleted) {
+        T distance = getDistance(node.point, query);
+        if (distance < *bestDist) {
+            *bestNode = node;
+            *bestDist = distance;
+        }
     }
     if (node.isLeaf())
         return;
 
     // Recursively compare nodes and find nearest neighbor
-    if (query[node.split_axis] < node.split_position && node.left_child != nullptr) {
-        getNearestNeighbor(*(node.left_child), query, bestNode, bestDist);
-        if (abs(node.split_position - query[node.split_axis]) < *bestDist
-            && node.right_child != nullptr) {
-            getNearestNeighbor(*(node.right_child), query, bestNode, bestDist);
-        }
+    bool left_first = query[node.split_axis] < node.split_position;
+    const shared_ptr<KdTreeNode<T>>& near_child = left_first ? node.left_child : node.right_child;
+    const shared_ptr<KdTreeNode<T>>& far_child = left_first ? node.right_child : node.left_child;
+    if (near_child != nullptr) {
+        getNearestNeighbor(*near_child, query, bestNode, bestDist);
     }
-    else if (node.right_child != nullptr) {
-        getNearestNeighbor(*(node.right_child), query, bestNode, bestDist);
-        if (abs(node.split_position - query[node.split_axis]) < *bestDist
-            && node.left_child != nullptr) {
-            getNearestNeighbor(*(node.left_child), query, bestNode, bestDist);
-        }
+    if (far_child != nullptr && abs(node.split_position - query[node.split_axis]) < *bestDist) {
+        getNearestNeighbor(*far_child, query, bestNode, bestDist);
     }
     return;
 }
 
 template <typename T>
 void KdTree<T>::WriteKDTreeToFile(const KdTree<T>& tree, const string& file) {
+    tree.materialize();
     ofstream out_stream(file);
     cereal::JSONOutputArchive archive(out_stream);
     archive(cereal::make_nvp("kdtree", tree));
@@ -25,22 +25,34 @@
 
 #include <vector>
 #include <memory>
+#include <limits>
+#include <atomic>
+#include <mutex>
 #include "kd_math.h"
+#include "kd_arena.h"
+#include "kd_point_set.h"
 #include <cereal/cereal.hpp>
 #include <cereal/types/memory.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/utility.hpp>
 #include <cereal/types/base_class.hpp>
 
+template <typename T> struct PendingSubtree;
+
 // Data structure for individual nodes of the KD-tree
 template <typename T=double>
 struct KdTreeNode {
     size_t depth;
-    size_t split_axis;
-    T split_position;
+    size_t split_axis = 0;
+    T split_position = T(0);
+    size_t size = 1;            // Number of points in the subtree rooted here
+    size_t deleted_count = 0;   // Number of those points that were erased
+    bool deleted = false;       // Tombstone for this node's point
+    std::vector<T> bounds;      // Subtree bounding box {min..., max...}, may be empty
     Point<T> point;
     std::shared_ptr<KdTreeNode<T>> left_child;
     std::shared_ptr<KdTreeNode<T>> right_child;
+    std::shared_ptr<PendingSubtree<T>> pending; // Children not built yet by a lazy build
 
     bool isLeaf() const {
         return (left_child == nullptr && right_child == nullptr);
@@ -56,19 +68,160 @@ struct KdTreeNode {
     template<class Archive>
     void serialize(Archive & archive) {
 			archive(CEREAL_NVP(depth), CEREAL_NVP(split_axis), CEREAL_NVP(split_position),
-                    CEREAL_NVP(point), CEREAL_NVP(left_child), CEREAL_NVP(right_child));
+                    CEREAL_NVP(size), CEREAL_NVP(deleted_count), CEREAL_NVP(deleted),
+                    CEREAL_NVP(bounds), CEREAL_NVP(point), CEREAL_NVP(left_child),
+                    CEREAL_NVP(right_child));
     }
 };
 
+// Points of both children of a lazily built node. The first search that
+// reaches the node builds the children under mutex and then sets built.
+// The input copies of a lazy build are freed with its last pending node.
+template <typename T=double>
+struct PendingSubtree {
+    std::shared_ptr<std::vector<Point<T>>> build_points;
+    std::shared_ptr<Arena> arena;       // Arena of the build, if any
+    std::vector<Point<T>*> left_points;
+    std::vector<Point<T>*> right_points;
+    std::vector<T> left_cell;
+    std::vector<T> right_cell;
+    std::atomic<bool> built{false};
+    std::mutex mutex;
+};
+
 // Parent class for the KD-tree
 template <typename T=double>
 class KdTree {
-private:
-    std::shared_ptr<KdTreeNode<T>> root_;
 public:
     enum class SplitMethod_t {CYCLE, VARIANCE, RANGE};
     static SplitMethod_t split_method_;
 
+    // Scapegoat balance factor used by insert(): a subtree is rebuilt once
+    // a child holds more than this fraction of its points
+    static double balance_factor_;
+
+    // Fraction of erased points at which erase() compacts a subtree
+    static double compaction_threshold_;
+
+    // Store the tight bounding box of every subtree and prune searches
+    // with the full box-to-query distance instead of one splitting plane
+    static bool tight_bounds_;
+
+    // Copy the build input into Morton (Z-order) before building
+    static bool morton_presort_;
+
+    // Run query batches in Morton order of the queries and report results
+    // in input order, so that consecutive queries share cached tree paths.
+    // Used by queryKdTree and queryFlatKdTree.
+    static bool morton_query_order_;
+
+    // Build in the principal-component basis of the input. Points and
+    // queries are rotated by the same matrix, so that splits follow the
+    // directions along which correlated features vary.
+    static bool pca_rotation_;
+
+    // Subsets of at most this many points are split at their exact median
+    // instead of an estimate from their mean and variance. VARIANCE and
+    // RANGE still choose the axis from the subset's own variance or
+    // bounding box; CYCLE reuses the parent's cell unless tight_bounds_.
+    static size_t range_stats_threshold_;
+
+    // Subsets of more than split_sample_threshold_ points estimate their
+    // split axis and position from split_sample_size_ points drawn at
+    // random (0 disables sampling). Each node seeds its own generator from
+    // split_sample_seed_, its depth, its size and the index of its first
+    // point, so builds are reproducible and siblings draw different samples.
+    static size_t split_sample_size_;
+    static size_t split_sample_threshold_;
+    static unsigned int split_sample_seed_;
+
+    // Build by sorting point indices once along every axis and keeping each
+    // axis in sorted order through the splits, instead of selecting a
+    // median at every node. Splits are at exact medians, so trees are
+    // balanced and build time is O(n log n) per axis.
+    static bool presorted_build_;
+
+    // Build only the root partition up front. Each node's children are
+    // built the first time a search reaches it, so a few localized queries
+    // never pay for the rest of the tree. Safe with concurrent searches.
+    // Modifying, serializing, flattening or reading nodes builds the whole
+    // tree first. Lazy builds use median selection, not presorted_build_.
+    static bool lazy_build_;
+    static size_t lazy_subtree_size_;   // Smaller subtrees are built at once
+
+    // Allocate the nodes and Point coordinates of a build from an arena of
+    // arena_block_bytes_ blocks, optionally on transparent huge pages,
+    // instead of one heap object each. The arena is released with the last
+    // node of the tree. Arenas are not thread safe, so subtrees built
+    // lazily by searches take a small arena of their own, without huge
+    // pages. Nodes added later by insert or rebuilds use the heap, so a
+    // long-lived tree does not grow its arena.
+    static bool arena_build_;
+    static size_t arena_block_bytes_;
+    static bool arena_huge_pages_;
+
+    // Similarity measure the tree is searched with. COSINE normalizes points
+    // at build and query time; INNER_PRODUCT appends an extra coordinate so
+    // that maximum inner product maps onto Euclidean nearest neighbor.
+    enum class Metric_t {EUCLIDEAN, COSINE, INNER_PRODUCT};
+
+private:
+    std::shared_ptr<KdTreeNode<T>> root_;
+    Metric_t metric_ = Metric_t::EUCLIDEAN;
+    T max_norm_ = T(0);     // Largest input norm, used by INNER_PRODUCT
+    bool copy_on_write_ = false;
+    std::vector<T> rotation_;   // Row-major PCA rotation, empty when unused
+    std::vector<T> variances_;  // Input variance along each rotated axis
+    std::weak_ptr<std::vector<Point<T>>> lazy_points_;  // Expires when nothing is pending
+
+    // Rebuild the subtree held by path[level] from its live points and
+    // update the subtree counts of the nodes above it
+    void rebuildSubtree(const std::vector<std::shared_ptr<KdTreeNode<T>>*>& path,
+                        const size_t& level);
+
+    // Replace every node on a root-to-node path with a private copy
+    static void detachPath(std::vector<std::shared_ptr<KdTreeNode<T>>*>& path);
+
+    // Copy every node of a subtree
+    static std::shared_ptr<KdTreeNode<T>> cloneSubtree(const std::shared_ptr<KdTreeNode<T>>& node);
+
+    // Tombstone the node at the end of a root-to-node path
+    void eraseAtPath(std::vector<std::shared_ptr<KdTreeNode<T>>*>& path);
+
+    // Depth-first search for the live node holding a Point index
+    static bool findPath(std::shared_ptr<KdTreeNode<T>>& slot, const size_t& index,
+                         std::vector<std::shared_ptr<KdTreeNode<T>>*>& path);
+
+    // Build the subtree of the points held in [begin, end) of every per-axis
+    // sorted index array, using buffer and side as scratch space
+    static shared_ptr<KdTreeNode<T>> presortedBuild(const std::vector<Point<T>*>& input_points,
+                                                    std::vector<std::vector<size_t>>& sorted,
+                                                    std::vector<size_t>& buffer,
+                                                    std::vector<char>& side, const size_t& begin,
+                                                    const size_t& end, const size_t depth,
+                                                    const std::shared_ptr<Arena>& arena);
+
+    // Recursively build KD-Tree inside a cell {min..., max...} that holds
+    // all input points (empty when not known). With lazy_points, large
+    // subsets are left pending on the node instead of built.
+    static shared_ptr<KdTreeNode<T>> treeBuild(const std::vector<Point<T>*>& input_points,
+                                               const size_t depth, const std::vector<T>& cell,
+                                               const std::shared_ptr<std::vector<Point<T>>>& lazy_points,
+                                               const std::shared_ptr<Arena>& arena);
+
+    // New node, from arena when given. Its Point is stored with
+    // Point<T>(point, arena.get()) so the coordinates share the arena.
+    static shared_ptr<KdTreeNode<T>> makeNode(const size_t depth,
+                                              const std::shared_ptr<Arena>& arena);
+
+    // Build the children of a node left pending by a lazy build, once
+    static void expandNode(const KdTreeNode<T>& node);
+
+    // Build every pending node of a subtree
+    static void expandSubtree(const std::shared_ptr<KdTreeNode<T>>& node);
+
+public:
+
     // Constructors/Destructor
     KdTree() = default;
     KdTree(const std::shared_ptr<KdTreeNode<T>> root_node);
@@ -79,13 +232,76 @@ public:
     KdTree<T> getLeftSubtree() const;
     KdTree<T> getRightSubtree() const;
     bool isEmpty() const;
+    Metric_t getMetric() const;
+    T getMaxNorm() const;
+    size_t size() const;                        // Number of live Points
+
+    // With copy-on-write enabled, insert/erase/compact copy every node they
+    // modify instead of changing it in place, so other KdTree copies that
+    // share the old root keep seeing an unchanged tree
+    void setCopyOnWrite(bool copy_on_write);
+
+    // Deep copy that shares no nodes with this tree, so updates to either
+    // one never show in the other. Pending lazy subtrees are built first.
+    KdTree<T> clone() const;
+
+    std::vector<Point<T>> getPoints() const;    // Copies of the live Points, unrotated
+
+    // Build all subtrees a lazy build has left pending
+    void materialize() const;
+
+    // PCA rotation applied before the metric mapping (empty when unused),
+    // and the fraction of the input variance along each rotated axis
+    const std::vector<T>& getRotation() const;
+    std::vector<T> getVarianceCaptured() const;
+
+    // Map a data or query Point into the Euclidean space the tree is built in
+    Point<T> toSearchSpace(const Point<T>& pt, bool is_query = false) const;
+
+    // Convert a search-space distance into the score reported for the metric
+    // (distance for EUCLIDEAN, similarity for COSINE and INNER_PRODUCT)
+    T toScore(const T& distance, const Point<T>& query) const;
+
+    // Same mappings for a given metric, for indexes derived from a KdTree
+    static Point<T> transformPoint(const Point<T>& pt, const Metric_t& metric,
+                                   const T& max_norm, bool is_query);
+    // Append the search-space coordinates of a row-major Point to
+    // search_coords, for indexes that store coordinate buffers
+    static void appendSearchCoords(const T* coords, const size_t& dimension, const Metric_t& metric,
+                                   const T& max_norm, bool is_query, std::vector<T>& search_coords);
+    static T transformScore(const T& distance, const Point<T>& query,
+                            const Metric_t& metric, const T& max_norm);
+
+    // Insert a Point, attaching it below the leaf it falls into. Subtrees
+    // that grow too unbalanced are rebuilt (scapegoat style).
+    void insert(const Point<T>& point);
+
+    // Mark the Point with the given index as deleted. Erased points are
+    // skipped by queries, and a subtree is rebuilt without them once its
+    // erased fraction exceeds compaction_threshold_. Looking a point up by
+    // index visits the whole tree; pass the Point itself for a single descent.
+    bool erase(const size_t& index);
+    bool erase(const Point<T>& point);
+
+    // Rebuild the whole tree without its erased points. Like insert and
+    // erase, this must not run while other threads search the same tree;
+    // use ConcurrentKdTree to update a tree that is being searched.
+    void compact();
+
+    // Collect copies of all live Points stored in a subtree (in search space)
+    static void collectPoints(const std::shared_ptr<KdTreeNode<T>>& node,
+                              std::vector<Point<T>>& points);
 
     // Start building KD-Tree from a set of Points
-    static KdTree<T> buildKdTree(const std::vector<Point<T>*>& input_points);
+    static KdTree<T> buildKdTree(const std::vector<Point<T>*>& input_points,
+                                 const Metric_t& metric = Metric_t::EUCLIDEAN);
+    static KdTree<T> buildKdTree(const PointSet<T>& input_points,
+                                 const Metric_t& metric = Metric_t::EUCLIDEAN);
 
-    // Recursively build KD-Tree
+    // Recursively build KD-Tree, with nodes allocated from arena when given
     static shared_ptr<KdTreeNode<T>> treeBuild(const std::vector<Point<T>*>& input_points,
-                                               const size_t depth);
+                                               const size_t depth,
+                                               const std::shared_ptr<Arena>& arena = nullptr);
 
     // Find appropriate splitting axis for given set of Points
     static size_t getSplitAxis(const std::vector<Point<T>>& distro_params,
@@ -98,6 +314,27 @@ public:
 
     // Query KD tree for a set of points
     static void queryKdTree(const KdTree<T>& tree, const std::vector<Point<T>*>& query_points);
+    static void queryKdTree(const KdTree<T>& tree, const PointSet<T>& query_points);
+
+    // Find the nearest neighbor of a single query under the tree's metric.
+    // Returns {point index, score}.
+    static std::pair<size_t, T> findNearest(const KdTree<T>& tree, const Point<T>& query);
+
+    // Warm-started search for streams of nearby queries. hint is the
+    // Point of a previous result as stored in the tree (in search space),
+    // and is replaced by the Point of this result; start a stream with an
+    // empty Point, which searches from the root. The search descends to
+    // the hinted Point, searches its subtree first and walks back up,
+    // visiting other subtrees only where they can beat the bound found so
+    // far. upper_bound seeds the bound, as a distance in the tree's search
+    // space. Returns {max, max} when no Point lies within upper_bound.
+    static std::pair<size_t, T> findNearest(const KdTree<T>& tree, const Point<T>& query,
+                                            Point<T>& hint,
+                                            const T& upper_bound = std::numeric_limits<T>::max());
+
+    // Distance from a query to the bounding box of a node's subtree
+    // (zero when the node stores no box)
+    static T getBoxDistance(const KdTreeNode<T>& node, const Point<T>& query);
 
     // Recursively find nearest neighbor in tree for a given point
     static void getNearestNeighbor(const KdTreeNode<T>& node,
@@ -108,7 +345,8 @@ public:
     // Serialization function
     template<class Archive>
     void serialize(Archive & archive) {
-			archive(CEREAL_NVP(root_), CEREAL_NVP(split_method_));
+			archive(CEREAL_NVP(root_), CEREAL_NVP(split_method_), CEREAL_NVP(metric_),
+                    CEREAL_NVP(max_norm_), CEREAL_NVP(rotation_), CEREAL_NVP(variances_));
     }
 
     // Read/Write KD-tree to .json file using Cereal
@@ -23,45 +23,130 @@
 #include <iostream>
 #include <string>
 #include "kd_math.h"
+#include "kd_point_set.h"
 #include "kd_tree.h"
+#include "kd_flat_tree.h"
+#include "kd_compact_tree.h"
+#include "kd_external.h"
+#include "kd_paged_tree.h"
 #include "file_handler.h"
 #include "nn_test.cpp"
 
 using namespace std;
 
+// Metric named on the command line; reports unknown names and returns false
+bool parseMetric(const char* name, KdTree<double>::Metric_t& metric) {
+    if (strcmp(name, "cosine")==0)
+        metric = KdTree<double>::Metric_t::COSINE;
+    else if (strcmp(name, "inner_product")==0)
+        metric = KdTree<double>::Metric_t::INNER_PRODUCT;
+    else if (strcmp(name, "euclidean")==0)
+        metric = KdTree<double>::Metric_t::EUCLIDEAN;
+    else {
+        cerr << "Unknown metric! Options are: euclidean, cosine, inner_product" << endl;
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char * argv[]) {
 
-    if (strcmp(argv[1], "--build")==0 && argc==3) {
-        vector<Point<double>*> input_data = FileHandler<double>::csvReadInput(argv[2]);
+    if (strcmp(argv[1], "--build")==0 && (argc==3 || argc==4)) {
+        KdTree<double>::Metric_t metric = KdTree<double>::Metric_t::EUCLIDEAN;
+        if (argc == 4 && !parseMetric(argv[3], metric))
+            return 1;
+        PointSet<double> input_data = FileHandler<double>::csvReadPointSet(argv[2]);
         cout << "CSV Parsing complete" << endl << "Building KD-Tree..." << endl;
-        KdTree<double> tree = KdTree<double>::buildKdTree(input_data);
+        KdTree<double> tree = KdTree<double>::buildKdTree(input_data, metric);
         cout << "KD-Tree built!" << endl;
+        vector<double> captured = tree.getVarianceCaptured();
+        if (!captured.empty()) {
+            cout << "Variance captured by each principal axis:";
+            for (auto iter = captured.begin(); iter != captured.end(); ++iter)
+                cout << " " << *iter;
+            cout << endl;
+        }
         KdTree<double>::WriteKDTreeToFile(tree);
     }
-    else if (strcmp(argv[1], "--query")==0 && argc >= 3) {
+    else if (strcmp(argv[1], "--build-external")==0 && (argc==3 || argc==4)) {
+        KdTree<double>::Metric_t metric = KdTree<double>::Metric_t::EUCLIDEAN;
+        if (argc == 4 && !parseMetric(argv[3], metric))
+            return 1;
+        cout << "Building flat KD-Tree out of core..." << endl;
+        size_t count = ExternalKdTreeBuilder<double>::buildFromFile(argv[2], "tree.kdx", metric);
+        cout << "Flat KD-Tree of " << count << " points written to tree.kdx" << endl;
+    }
+    else if (strcmp(argv[1], "--flatten")==0 && (argc==3 || argc==4)) {
+        FlatKdTree<double>::Layout_t layout = FlatKdTree<double>::Layout_t::VEB;
+        if (argc == 4) {
+            if (strcmp(argv[3], "preorder")==0)
+                layout = FlatKdTree<double>::Layout_t::PREORDER;
+            else if (strcmp(argv[3], "bfs")==0)
+                layout = FlatKdTree<double>::Layout_t::BFS;
+            else if (strcmp(argv[3], "veb")!=0) {
+                cerr << "Unknown layout! Options are: preorder, bfs, veb" << endl;
+                return 1;
+            }
+        }
         KdTree<double> saved_tree;
-        if (argc == 4)
-            KdTree<double>::ReadKDTreeFromFile(saved_tree, argv[3]);
-        else
-            KdTree<double>::ReadKDTreeFromFile(saved_tree);
+        KdTree<double>::ReadKDTreeFromFile(saved_tree, argv[2]);
+        cout << "Flattening KD-Tree..." << endl;
+        FlatKdTree<double> flat_tree = FlatKdTree<double>::flatten(saved_tree, layout);
+        FlatKdTree<double>::WriteFlatKdTreeToFile(flat_tree);
+        cout << "Flat KD-Tree written to tree.kdx" << endl;
+        CompactKdTree<double, float> compact_tree = CompactKdTree<double, float>::encode(saved_tree);
+        cout << "Node bytes per point: flat " << flat_tree.getNodeBytesPerPoint()
+             << ", compact " << compact_tree.getNodeBytesPerPoint() << endl;
+    }
+    else if (strcmp(argv[1], "--query")==0 && argc >= 3) {
+        string tree_file = (argc >= 4) ? argv[3] : "data/sample_tree.json";
+        bool flat = tree_file.size() > 4 && tree_file.substr(tree_file.size()-4) == ".kdx";
+        bool paged = flat && argc == 5 && strcmp(argv[4], "paged")==0;
 
         cout << "Reading query data" << endl;
-        vector<Point<double>*> query_data = FileHandler<double>::csvReadInput(argv[2]);
-        cout << "Finding nearest neighbors..." << endl;
-        KdTree<double>::queryKdTree(saved_tree, query_data);
+        PointSet<double> query_data = FileHandler<double>::csvReadPointSet(argv[2]);
+        KdTree<double>::Metric_t metric;
+        if (paged) {
+            PagedKdTree<double> paged_tree = PagedKdTree<double>::open(tree_file);
+            metric = paged_tree.getMetric();
+            cout << "Finding nearest neighbors..." << endl;
+            PagedKdTree<double>::queryPagedKdTree(paged_tree, query_data);
+            cout << "Page cache hit rate: " << paged_tree.getCacheHitRate() << endl;
+        }
+        else if (flat) {
+            FlatKdTree<double> flat_tree;
+            FlatKdTree<double>::ReadFlatKdTreeFromFile(flat_tree, tree_file);
+            metric = flat_tree.getMetric();
+            cout << "Finding nearest neighbors..." << endl;
+            FlatKdTree<double>::queryFlatKdTree(flat_tree, query_data);
+        }
+        else {
+            KdTree<double> saved_tree;
+            KdTree<double>::ReadKDTreeFromFile(saved_tree, tree_file);
+            metric = saved_tree.getMetric();
+            cout << "Finding nearest neighbors..." << endl;
+            KdTree<double>::queryKdTree(saved_tree, query_data);
+        }
 
         cout << "Finding nearest neighbors using brute force (for sample_data.csv)..." << endl;
-        vector<Point<double>*> input_data = FileHandler<double>::csvReadInput("data/sample_data.csv");
-        nnBruteForce(query_data, input_data);
+        PointSet<double> input_data = FileHandler<double>::csvReadPointSet("data/sample_data.csv");
+        nnBruteForce(query_data, input_data, metric);
         cout << "Done";
     }
     else if (strcmp(argv[1], "--help")==0) {
         cout << "///////////////////////////////////////////////////////////" << endl;
         cout << "KD-Tree Library" << endl << "Copyright (c) 2017 Aum Jadhav" << endl << endl;
         cout << "Usage:" << endl;
-        cout << "1. Build KD-Tree: $./KDTree --build <path/input_file.csv>" << endl;
+        cout << "1. Build KD-Tree: $./KDTree --build <path/input_file.csv> ";
+        cout << "<metric>(optional: euclidean, cosine, inner_product; default=euclidean)" << endl;
         cout << "2. Query KD-Tree for Nearest Neighbors: ";
-        cout << "$./KDTree --query <path/query_file.csv> <path/tree.json>(optional, default=data/sample_tree.json)" << endl;
+        cout << "$./KDTree --query <path/query_file.csv> <path/tree.json or tree.kdx>(optional, default=data/sample_tree.json) ";
+        cout << "<paged>(optional for tree.kdx: read pages on demand)" << endl;
+        cout << "3. Flatten KD-Tree into a binary index: $./KDTree --flatten <path/tree.json> ";
+        cout << "<layout>(optional: preorder, bfs, veb; default=veb)" << endl;
+        cout << "4. Build a flat binary index without loading the input into memory: ";
+        cout << "$./KDTree --build-external <path/input_file.csv> ";
+        cout << "<metric>(optional: euclidean, cosine, inner_product; default=euclidean)" << endl;
         cout << "///////////////////////////////////////////////////////////" << endl;
     }
     else {
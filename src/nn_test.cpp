@@ -22,31 +22,127 @@
 
 #include <vector>
 #include <numeric>
+#include <limits>
+#include <cmath>
+#include <utility>
 #include "kd_math.h"
+#include "kd_point_set.h"
 #include "file_handler.h"
+#include "kd_tree.h"
 
 using namespace std;
 
-// Function for finding the nearest neighbor using brute force
+// Nearest neighbor of a single query using brute force. Returns {point
+// index, score} like KdTree::findNearest: the distance for EUCLIDEAN and
+// the highest similarity for COSINE and INNER_PRODUCT.
+template <typename T>
+pair<size_t, T> nnBruteForce(const vector<Point<T>*>& sample_points, const Point<T>& query,
+                             typename KdTree<T>::Metric_t metric = KdTree<T>::Metric_t::EUCLIDEAN) {
+    typedef typename KdTree<T>::Metric_t Metric_t;
+    Point<T> unit_query = (metric == Metric_t::COSINE) ? normalize(query) : query;
+    size_t bestNode = numeric_limits<size_t>::max();
+    T bestDist = (metric == Metric_t::EUCLIDEAN) ? numeric_limits<T>::max()
+                                                 : numeric_limits<T>::lowest();
+    for(auto iter = sample_points.begin(); iter != sample_points.end(); ++iter) {
+        T score;
+        bool better;
+        if (metric == Metric_t::EUCLIDEAN) {
+            score = getDistance(query, **iter);
+            better = score < bestDist;
+        }
+        else {
+            score = (metric == Metric_t::COSINE) ? dotProduct(unit_query, normalize(**iter))
+                                                 : dotProduct(query, **iter);
+            better = score > bestDist;
+        }
+        if (better){
+            bestNode = (**iter).getIndex();
+            bestDist = score;
+        }
+    }
+    return make_pair(bestNode, bestDist);
+}
+
+// Function for finding the nearest neighbor using brute force.
+// For COSINE and INNER_PRODUCT the best match is the highest similarity.
 
 template <typename T>
-void nnBruteForce(const vector<Point<T>*>& query_points, vector<Point<T>*>& sample_points) {
+void nnBruteForce(const vector<Point<T>*>& query_points, vector<Point<T>*>& sample_points,
+                  typename KdTree<T>::Metric_t metric = KdTree<T>::Metric_t::EUCLIDEAN) {
     vector<size_t> pointId;
     pointId.reserve(query_points.size());
     vector<T> dist;
     dist.reserve(query_points.size());
-    for (auto iter1 = query_points.begin(); iter1 != query_points.end(); ++iter1) {
+    for (auto iter = query_points.begin(); iter != query_points.end(); ++iter) {
+        pair<size_t, T> nearest = nnBruteForce(sample_points, **iter, metric);
+        pointId.push_back(nearest.first);
+        dist.push_back(nearest.second);
+    }
+    FileHandler<T>::csvWriteNnResults(pointId, dist, "query_results_truth.csv");
+}
+
+// Copy of a PointSet with every Point scaled to unit norm, as normalize()
+template <typename T>
+PointSet<T> normalizeSet(const PointSet<T>& points) {
+    PointSet<T> unit_points(points.getDimension());
+    unit_points.reserve(points.size());
+    vector<T> unit_vect(points.getDimension());
+    for (size_t i = 0; i < points.size(); ++i) {
+        PointView<T> pt = points[i];
+        T norm = sqrt(inner_product(pt.begin(), pt.end(), pt.begin(), T(0.0)));
+        for (size_t axis = 0; axis < pt.getDimension(); ++axis) {
+            unit_vect[axis] = (norm == T(0.0)) ? pt[axis] : pt[axis] / norm;
+        }
+        unit_points.push_back(unit_vect.data(), unit_vect.size(), pt.getIndex());
+    }
+    return unit_points;
+}
+
+// Brute force over PointSets, reading coordinates in place
+template <typename T>
+void nnBruteForce(const PointSet<T>& query_points, const PointSet<T>& sample_points,
+                  typename KdTree<T>::Metric_t metric = KdTree<T>::Metric_t::EUCLIDEAN) {
+    typedef typename KdTree<T>::Metric_t Metric_t;
+    if (metric == Metric_t::COSINE) {
+        PointSet<T> unit_queries = normalizeSet(query_points);
+        PointSet<T> unit_samples = normalizeSet(sample_points);
+        nnBruteForce(unit_queries, unit_samples, Metric_t::INNER_PRODUCT);
+        return;
+    }
+
+    size_t dimension = sample_points.getDimension();
+    vector<size_t> pointId;
+    pointId.reserve(query_points.size());
+    vector<T> dist;
+    dist.reserve(query_points.size());
+    for (size_t query = 0; query < query_points.size(); ++query) {
+        const T* query_coords = query_points[query].begin();
         size_t bestNode = numeric_limits<size_t>::max();
-        T bestDist = numeric_limits<T>::max();
-        for(auto iter2 = sample_points.begin(); iter2 != sample_points.end(); ++iter2) {
-            T dist = getDistance(**iter1, **iter2);
-            if (dist < bestDist){
-                bestNode = (**iter2).getIndex();
-                bestDist = dist;
+        T bestDist = (metric == Metric_t::EUCLIDEAN) ? numeric_limits<T>::max()
+                                                     : numeric_limits<T>::lowest();
+        const T* coords = sample_points.data();
+        for (size_t sample = 0; sample < sample_points.size(); ++sample, coords += dimension) {
+            // Squared distances while scanning, one square root per query
+            T score = T(0.0);
+            bool better;
+            if (metric == Metric_t::EUCLIDEAN) {
+                for (size_t axis = 0; axis < dimension; ++axis) {
+                    T diff = query_coords[axis] - coords[axis];
+                    score += diff*diff;
+                }
+                better = score < bestDist;
+            }
+            else {
+                score = inner_product(query_coords, query_coords + dimension, coords, T(0.0));
+                better = score > bestDist;
+            }
+            if (better){
+                bestNode = sample_points.getIds()[sample];
+                bestDist = score;
             }
         }
         pointId.push_back(bestNode);
-        dist.push_back(bestDist);
+        dist.push_back((metric == Metric_t::EUCLIDEAN) ? sqrt(bestDist) : bestDist);
     }
     FileHandler<T>::csvWriteNnResults(pointId, dist, "query_results_truth.csv");
 }
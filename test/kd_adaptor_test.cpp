@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <vector>
+#include "kd_test.h"
+#include "kd_point_set.h"
+#include "kd_adaptor.h"
+
+using namespace std;
+
+namespace {
+
+// Adaptor trees over the same Points must answer like brute force
+void checkAdaptorTree(const AdaptorKdTree<double>& tree, vector<Point<double>>& points,
+                      const vector<Point<double>>& queries) {
+    KD_CHECK(tree.getDimension() == points.front().getDimension());
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter)
+        KD_CHECK(matchesBruteForce(tree.findNearest(*iter), nnBruteForce(getPointers(points), *iter)));
+}
+
+}
+
+// Row-major, column-major and strided buffers, each adaptor passed as a
+// temporary the tree has to keep its own copy of
+KD_TEST(testAdaptorBufferLayouts) {
+    const size_t count = 700;
+    const size_t dimension = 3;
+    const size_t padding = 2;
+    vector<Point<double>> points = getRandomPoints<double>(count, dimension, 11);
+    vector<Point<double>> queries = getRandomPoints<double>(100, dimension, 12);
+
+    vector<double> row_major, strided_rows(count*(dimension + padding), -9.0);
+    vector<double> column_major(count*dimension), strided_columns((count + padding)*dimension, -9.0);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            row_major.push_back(points[i][axis]);
+            strided_rows[i*(dimension + padding) + axis] = points[i][axis];
+            column_major[axis*count + i] = points[i][axis];
+            strided_columns[axis*(count + padding) + i] = points[i][axis];
+        }
+    }
+
+    typedef BufferAdaptor<double>::Order_t Order_t;
+    for (int split = 0; split < 2; ++split) {
+        ScopedSetting<KdTree<double>::SplitMethod_t> split_method(KdTree<double>::split_method_,
+            (split == 0) ? KdTree<double>::SplitMethod_t::VARIANCE : KdTree<double>::SplitMethod_t::CYCLE);
+        checkAdaptorTree(AdaptorKdTree<double>::build(
+            BufferAdaptor<double>(row_major.data(), count, dimension)), points, queries);
+        checkAdaptorTree(AdaptorKdTree<double>::build(
+            BufferAdaptor<double>(column_major.data(), count, dimension, Order_t::COLUMN_MAJOR)),
+            points, queries);
+        checkAdaptorTree(AdaptorKdTree<double>::build(
+            BufferAdaptor<double>(strided_rows.data(), count, dimension, Order_t::ROW_MAJOR,
+                                  dimension + padding)), points, queries);
+        checkAdaptorTree(AdaptorKdTree<double>::build(
+            BufferAdaptor<double>(strided_columns.data(), count, dimension, Order_t::COLUMN_MAJOR,
+                                  count + padding)), points, queries);
+    }
+}
+
+// A PointSet viewed in place reports positions in the set
+KD_TEST(testAdaptorPointSet) {
+    vector<Point<double>> points = getRandomPoints<double>(300, 4, 13);
+    PointSet<double> set(4);
+    for (auto iter = points.begin(); iter != points.end(); ++iter)
+        set.push_back(*iter);
+    AdaptorKdTree<double> tree = AdaptorKdTree<double>::build(BufferAdaptor<double>(set));
+    KD_CHECK(tree.getMemoryUsage() == points.size()*sizeof(FlatKdNode<double>));
+    checkAdaptorTree(tree, points, getRandomPoints<double>(50, 4, 14));
+
+    KD_CHECK(AdaptorKdTree<double>::build(BufferAdaptor<double>()).isEmpty());
+}
@@ -0,0 +1,122 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <stdint.h>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "kd_test.h"
+#include "kd_arena.h"
+
+using namespace std;
+
+// Allocations are aligned, fit in the reserved blocks, and requests
+// larger than a block get a block of their own
+KD_TEST(testArenaAllocate) {
+    for (int huge = 0; huge < 2; ++huge) {
+        Arena arena(4096, huge == 1);
+        size_t alignments[] = {1, 8, 16, 64};
+        for (size_t i = 0; i < 400; ++i) {
+            size_t alignment = alignments[i % 4];
+            void* memory = arena.allocate(24 + i % 40, alignment);
+            KD_CHECK(memory != nullptr && reinterpret_cast<uintptr_t>(memory) % alignment == 0);
+        }
+        size_t blocks = arena.getBlockCount();
+        KD_CHECK((huge == 1 || blocks > 1) && arena.getUsedBytes() <= arena.getReservedBytes());
+        arena.allocate((huge == 1) ? (size_t(3) << 20) : 3*4096, 8);
+        KD_CHECK(arena.getBlockCount() == blocks + 1);
+        KD_CHECK(arena.getUsedBytes() <= arena.getReservedBytes());
+    }
+}
+
+// Arena builds answer like brute force, also lazily built, and keep
+// working after the tree they were copied from is gone and after updates
+KD_TEST(testArenaBuild) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    ScopedSetting<bool> arena_build(KdTree<double>::arena_build_, true);
+    ScopedSetting<size_t> arena_block_bytes(KdTree<double>::arena_block_bytes_, 4096);
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 221);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 222);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int lazy = 0; lazy < 2; ++lazy) {
+        ScopedSetting<bool> lazy_build(KdTree<double>::lazy_build_, lazy == 1);
+        for (size_t m = 0; m < 3; ++m) {
+            KdTree<double> tree;
+            {
+                KdTree<double> built = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+                tree = built;
+            }
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                           nnBruteForce(getPointers(points), *iter, metrics[m])));
+            }
+        }
+    }
+
+    vector<Point<double>> built(points.begin(), points.begin() + 1500);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(built));
+    vector<Point<double>> remaining;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i >= built.size())
+            tree.insert(points[i]);
+        if (i % 5 == 0)
+            tree.erase(points[i]);
+        else
+            remaining.push_back(points[i]);
+    }
+    tree.compact();
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                   nnBruteForce(getPointers(remaining), *iter)));
+    }
+}
+
+// Searches on several threads expand a lazy arena build at the same time
+KD_TEST(testArenaLazyThreads) {
+    ScopedSetting<bool> arena_build(KdTree<double>::arena_build_, true);
+    ScopedSetting<bool> lazy_build(KdTree<double>::lazy_build_, true);
+    ScopedSetting<size_t> lazy_subtree_size(KdTree<double>::lazy_subtree_size_, 16);
+    vector<Point<double>> points = getRandomPoints<double>(5000, 3, 226);
+    vector<Point<double>> queries = getRandomPoints<double>(200, 3, 227);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+
+    vector<pair<size_t, double>> truth;
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        truth.push_back(nnBruteForce(getPointers(points), *iter));
+    }
+    vector<size_t> mismatches(4, 0);
+    vector<thread> readers;
+    for (size_t reader = 0; reader < 4; ++reader) {
+        readers.push_back(thread([&, reader]() {
+            for (size_t i = 0; i < queries.size(); ++i) {
+                size_t query = (i + 53*reader) % queries.size();
+                if (!matchesBruteForce(KdTree<double>::findNearest(tree, queries[query]), truth[query]))
+                    ++mismatches[reader];
+            }
+        }));
+    }
+    for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+        iter->join();
+    }
+    KD_CHECK(mismatches == vector<size_t>(4, 0));
+}
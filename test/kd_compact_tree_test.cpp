@@ -0,0 +1,61 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <vector>
+#include "kd_test.h"
+#include "kd_flat_tree.h"
+#include "kd_compact_tree.h"
+
+using namespace std;
+
+// Compact trees with full and reduced precision split positions answer
+// like brute force under every metric, without the Points erased before
+// encoding
+KD_TEST(testCompactTree) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(1200, 3, 41);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 42);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t m = 0; m < 3; ++m) {
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+        vector<Point<double>> live;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (i % 5 == 0)
+                tree.erase(i);
+            else
+                live.push_back(points[i]);
+        }
+
+        CompactKdTree<double> compact = CompactKdTree<double>::encode(tree);
+        CompactKdTree<double, float> compact_float = CompactKdTree<double, float>::encode(tree);
+        KD_CHECK(compact.getNodeCount() == live.size());
+        KD_CHECK(compact_float.getNodeBytesPerPoint() < compact.getNodeBytesPerPoint());
+        KD_CHECK(compact.getNodeBytesPerPoint()
+                 < FlatKdTree<double>::flatten(tree).getNodeBytesPerPoint());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            pair<size_t, double> truth = nnBruteForce(getPointers(live), *iter, metrics[m]);
+            KD_CHECK(matchesBruteForce(compact.findNearest(*iter), truth));
+            KD_CHECK(matchesBruteForce(compact_float.findNearest(*iter), truth));
+        }
+    }
+}
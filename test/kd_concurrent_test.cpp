@@ -0,0 +1,97 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "kd_test.h"
+#include "kd_concurrent.h"
+
+using namespace std;
+
+// Updates to the KdTree a ConcurrentKdTree was built from must not reach
+// its published versions
+KD_TEST(testConcurrentCopiesTree) {
+    vector<Point<double>> points = getRandomPoints<double>(500, 3, 1);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    ConcurrentKdTree<double> concurrent(tree);
+
+    Point<double> query({0.25, -0.5, 0.75});
+    pair<size_t, double> before = concurrent.findNearest(query);
+    tree.insert(Point<double>(query.getPointVector(), 9999));
+    tree.erase(before.first);
+    KD_CHECK(concurrent.findNearest(query) == before);
+    KD_CHECK(KdTree<double>::findNearest(tree, query).first == 9999);
+}
+
+// Readers search while a writer inserts and erases. Every snapshot a reader
+// sees must answer like brute force over its own Points, and the final
+// version like brute force over the surviving Points.
+KD_TEST(testConcurrentReadersAndWriter) {
+    vector<Point<double>> points = getRandomPoints<double>(400, 2, 2);
+    vector<Point<double>> inserts = getRandomPoints<double>(200, 2, 3);
+    vector<Point<double>> queries = getRandomPoints<double>(64, 2, 4);
+    ConcurrentKdTree<double> concurrent(KdTree<double>::buildKdTree(getPointers(points)));
+
+    atomic<bool> writing(true);
+    atomic<size_t> mismatches(0);
+    atomic<size_t> snapshots(0);
+    vector<thread> readers;
+    for (size_t reader = 0; reader < 3; ++reader) {
+        readers.push_back(thread([&, reader]() {
+            size_t query = reader;
+            do {
+                ConcurrentKdTree<double>::ReadGuard guard(concurrent);
+                vector<Point<double>> live = guard.getTree().getPoints();
+                const Point<double>& query_point = queries[query++ % queries.size()];
+                if (live.size() != guard.getTree().size()
+                    || !matchesBruteForce(KdTree<double>::findNearest(guard.getTree(), query_point),
+                                          nnBruteForce(getPointers(live), query_point)))
+                    ++mismatches;
+                ++snapshots;
+            } while (writing.load());
+        }));
+    }
+
+    for (size_t i = 0; i < inserts.size(); ++i) {
+        concurrent.insert(Point<double>(inserts[i].getPointVector(), int(points.size() + i)));
+        concurrent.erase(2*i);
+    }
+    concurrent.compact();
+    writing.store(false);
+    for (auto iter = readers.begin(); iter != readers.end(); ++iter)
+        iter->join();
+    KD_CHECK(mismatches.load() == 0);
+    KD_CHECK(snapshots.load() > 0);
+
+    vector<Point<double>> live;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i % 2 == 1 || i >= 2*inserts.size())
+            live.push_back(points[i]);
+    }
+    for (size_t i = 0; i < inserts.size(); ++i)
+        live.push_back(Point<double>(inserts[i].getPointVector(), int(points.size() + i)));
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter)
+        KD_CHECK(matchesBruteForce(concurrent.findNearest(*iter), nnBruteForce(getPointers(live), *iter)));
+    KD_CHECK(concurrent.getRetiredCount() == 0);
+}
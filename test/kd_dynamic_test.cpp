@@ -0,0 +1,73 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <limits>
+#include <vector>
+#include "kd_test.h"
+#include "kd_dynamic.h"
+
+using namespace std;
+
+// Dynamic trees answer like brute force after every few inserts, with
+// buffers small enough to merge often and large enough to scan alone
+KD_TEST(testDynamicInsert) {
+    vector<Point<double>> points = getRandomPoints<double>(1500, 3, 151);
+    vector<Point<double>> queries = getRandomPoints<double>(50, 3, 152);
+    size_t capacities[] = {1, 7, 64, 4096};
+    for (size_t c = 0; c < 4; ++c) {
+        DynamicKdTree<double> tree(capacities[c]);
+        KD_CHECK(tree.isEmpty());
+        KD_CHECK(tree.findNearest(queries[0]).first == numeric_limits<size_t>::max());
+        for (size_t i = 0; i < points.size(); ++i) {
+            tree.insert(points[i]);
+            if ((i+1) % 250 != 0)
+                continue;
+            vector<Point<double>> inserted(points.begin(), points.begin() + i + 1);
+            KD_CHECK(tree.size() == inserted.size());
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                KD_CHECK(matchesBruteForce(tree.findNearest(*iter),
+                                           nnBruteForce(getPointers(inserted), *iter)));
+            }
+        }
+        // Level i holds capacity * 2^i Points
+        size_t levels = tree.getLevelCount();
+        KD_CHECK(levels == 0 || (size_t(1) << (levels-1))*capacities[c] <= points.size());
+    }
+}
+
+// Merged levels of a DynamicKdTree ignore the build policies
+KD_TEST(testDynamicLevelsIgnorePolicies) {
+    ScopedSetting<bool> pca_rotation(KdTree<double>::pca_rotation_, true);
+    ScopedSetting<bool> morton_presort(KdTree<double>::morton_presort_, true);
+    vector<Point<double>> points = getRandomPoints<double>(700, 3, 73);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 74);
+    DynamicKdTree<double> tree(16);
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        tree.insert(*iter);
+    }
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        KD_CHECK(matchesBruteForce(tree.findNearest(*iter),
+                                   nnBruteForce(getPointers(points), *iter,
+                                                KdTree<double>::Metric_t::EUCLIDEAN)));
+    }
+}
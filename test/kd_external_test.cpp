@@ -0,0 +1,112 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+#include "kd_test.h"
+#include "kd_external.h"
+
+using namespace std;
+
+namespace {
+
+const char* const external_test_input = "test_external_input.csv";
+const char* const external_test_file = "test_external_tree.kdx";
+
+void writeCsv(const vector<Point<double>>& points, const string& file) {
+    ofstream out_stream(file);
+    out_stream << setprecision(17);
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        for (size_t axis = 0; axis < iter->getDimension(); ++axis)
+            out_stream << ((axis > 0) ? "," : "") << (*iter)[axis];
+        out_stream << "\n";
+    }
+}
+
+// Number of rotation entries recorded in a flat KD-tree file header
+uint64_t getRotationSize(const string& file) {
+    vector<uint64_t> header(10);
+    ifstream in_stream(file, ios::binary);
+    in_stream.read(reinterpret_cast<char*>(header.data()), header.size()*sizeof(uint64_t));
+    return header[9];
+}
+
+}
+
+// Files built out of core, split into several runs, answer like brute
+// force under every metric, with and without PCA rotation and tight bounds
+KD_TEST(testExternalBuild) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    ScopedSetting<size_t> sample_size(ExternalKdTreeBuilder<double>::sample_size_, 300);
+    ScopedSetting<size_t> partition_points(ExternalKdTreeBuilder<double>::partition_points_, 200);
+    vector<Point<double>> points = getRandomPoints<double>(3000, 3, 101);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 102);
+    writeCsv(points, external_test_input);
+
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int pca = 0; pca < 2; ++pca) {
+        ScopedSetting<bool> pca_rotation(KdTree<double>::pca_rotation_, pca == 1);
+        for (int bounds = 0; bounds < 2; ++bounds) {
+            ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+            for (size_t m = 0; m < 3; ++m) {
+                size_t count = ExternalKdTreeBuilder<double>::buildFromFile(external_test_input,
+                                                                            external_test_file,
+                                                                            metrics[m]);
+                KD_CHECK(count == points.size());
+                KD_CHECK(getRotationSize(external_test_file) == ((pca == 1) ? 9u : 0u));
+                FlatKdTree<double> flat;
+                FlatKdTree<double>::ReadFlatKdTreeFromFile(flat, external_test_file);
+                KD_CHECK(flat.getNodeCount() == points.size());
+                for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                    KD_CHECK(matchesBruteForce(flat.findNearest(*iter),
+                                               nnBruteForce(getPointers(points), *iter, metrics[m])));
+                }
+            }
+        }
+    }
+    remove(external_test_input);
+    remove(external_test_file);
+}
+
+// Runs are removed when the build throws after writing them
+KD_TEST(testExternalBuildRemovesRuns) {
+    ScopedSetting<size_t> sample_size(ExternalKdTreeBuilder<double>::sample_size_, 100);
+    ScopedSetting<size_t> partition_points(ExternalKdTreeBuilder<double>::partition_points_, 200);
+    writeCsv(getRandomPoints<double>(1000, 3, 225), external_test_input);
+    bool thrown = false;
+    try {
+        ExternalKdTreeBuilder<double>::buildFromFile(external_test_input, "no_such_dir/tree.kdx",
+                                                     KdTree<double>::Metric_t::EUCLIDEAN,
+                                                     "test_external_run");
+    }
+    catch (const runtime_error&) {
+        thrown = true;
+    }
+    KD_CHECK(thrown);
+    KD_CHECK(!ifstream("test_external_run.0").good());
+    remove(external_test_input);
+}
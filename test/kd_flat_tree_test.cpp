@@ -0,0 +1,262 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "kd_test.h"
+#include "kd_flat_tree.h"
+
+using namespace std;
+
+namespace {
+
+const char* const flat_test_file = "test_flat_tree.kdx";
+
+// Flat trees answer like brute force over the Points they were built from
+void checkFlatTree(const FlatKdTree<double>& flat, vector<Point<double>>& points,
+                   const vector<Point<double>>& queries) {
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter)
+        KD_CHECK(matchesBruteForce(flat.findNearest(*iter), nnBruteForce(getPointers(points), *iter)));
+}
+
+}
+
+// Every layout and Point order, with and without tight bounds, also after
+// a round trip through a file
+KD_TEST(testFlatTreeLayouts) {
+    typedef FlatKdTree<double>::Layout_t Layout_t;
+    typedef FlatKdTree<double>::PointOrder_t PointOrder_t;
+    vector<Point<double>> points = getRandomPoints<double>(1500, 3, 31);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 32);
+    Layout_t layouts[] = {Layout_t::PREORDER, Layout_t::BFS, Layout_t::VEB};
+    PointOrder_t point_orders[] = {PointOrder_t::SUBTREE, PointOrder_t::NODE};
+    for (int bounds = 0; bounds < 2; ++bounds) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+        for (size_t layout = 0; layout < 3; ++layout) {
+            for (size_t order = 0; order < 2; ++order) {
+                FlatKdTree<double> flat = FlatKdTree<double>::flatten(tree, layouts[layout], 512,
+                                                                      point_orders[order]);
+                KD_CHECK(flat.getLayout() == layouts[layout]);
+                checkFlatTree(flat, points, queries);
+
+                FlatKdTree<double>::WriteFlatKdTreeToFile(flat, flat_test_file);
+                FlatKdTree<double> read;
+                FlatKdTree<double>::ReadFlatKdTreeFromFile(read, flat_test_file);
+                KD_CHECK(read.getNodeCount() == flat.getNodeCount());
+                checkFlatTree(read, points, queries);
+            }
+        }
+    }
+    remove(flat_test_file);
+}
+
+// BFS blocks never cross a block_bytes boundary, in the node array or in
+// the file, which starts the node array on a boundary
+KD_TEST(testFlatTreeBlockPadding) {
+    const size_t block_bytes = 4096;
+    vector<Point<double>> points = getRandomPoints<double>(3000, 2, 33);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    FlatKdTree<double> flat = FlatKdTree<double>::flatten(tree, FlatKdTree<double>::Layout_t::BFS,
+                                                          block_bytes);
+    KD_CHECK(flat.getNodeCount() >= points.size());
+    FlatKdTree<double>::WriteFlatKdTreeToFile(flat, flat_test_file);
+
+    // Header, max norm and the empty rotation come first, padded to a block
+    vector<FlatKdNode<double>> nodes(flat.getNodeCount());
+    ifstream in_stream(flat_test_file, ios::binary);
+    in_stream.seekg(block_bytes);
+    in_stream.read(reinterpret_cast<char*>(nodes.data()), nodes.size()*sizeof(FlatKdNode<double>));
+    KD_CHECK(in_stream.good());
+    in_stream.close();
+    remove(flat_test_file);
+
+    const uint32_t null_node = FlatKdTree<double>::null_node_;
+    size_t reached = 0;
+    vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        uint32_t node = stack.back();
+        stack.pop_back();
+        ++reached;
+        size_t first_byte = node*sizeof(FlatKdNode<double>);
+        size_t last_byte = first_byte + sizeof(FlatKdNode<double>) - 1;
+        KD_CHECK(first_byte/block_bytes == last_byte/block_bytes);
+        KD_CHECK(nodes[node].point != null_node);
+        if (nodes[node].left_child != null_node)
+            stack.push_back(nodes[node].left_child);
+        if (nodes[node].right_child != null_node)
+            stack.push_back(nodes[node].right_child);
+    }
+    KD_CHECK(reached == points.size());
+    checkFlatTree(flat, points, getRandomPoints<double>(100, 2, 34));
+}
+
+// Small subtrees share BFS blocks, so padding keeps the node array within
+// a small factor of the Point count at every block size
+KD_TEST(testFlatTreeBlockPacking) {
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 224);
+    size_t point_counts[] = {1, 7, 5000};
+    size_t block_sizes[] = {16, 64, 256, 1000, 4096, 65536};
+    for (size_t count = 0; count < 3; ++count) {
+        vector<Point<double>> points = getRandomPoints<double>(point_counts[count], 3, 223);
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+        for (size_t block = 0; block < 6; ++block) {
+            FlatKdTree<double> flat = FlatKdTree<double>::flatten(tree, FlatKdTree<double>::Layout_t::BFS,
+                                                                  block_sizes[block]);
+            KD_CHECK(flat.getNodeCount() >= points.size());
+            KD_CHECK(flat.getNodeCount() < 2*points.size());
+            if (block_sizes[block] >= 4096)
+                KD_CHECK(flat.getNodeCount() <= points.size() + points.size()/10);
+            checkFlatTree(flat, points, queries);
+        }
+    }
+}
+
+// Interleaved batches agree with single queries for every group size,
+// including groups larger than the batch
+KD_TEST(testFlatTreeBatch) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(2000, 4, 36);
+    vector<Point<double>> queries = getRandomPoints<double>(150, 4, 37);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE};
+    for (int bounds = 0; bounds < 2; ++bounds) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+        for (size_t m = 0; m < 2; ++m) {
+            FlatKdTree<double> flat = FlatKdTree<double>::flatten(
+                KdTree<double>::buildKdTree(getPointers(points), metrics[m]));
+            size_t group_sizes[] = {1, 3, 8, 500};
+            for (size_t g = 0; g < 4; ++g) {
+                vector<pair<size_t, double>> batch = flat.findNearestBatch(getPointers(queries),
+                                                                           group_sizes[g]);
+                KD_CHECK(batch.size() == queries.size());
+                for (size_t i = 0; i < queries.size(); ++i) {
+                    KD_CHECK(matchesBruteForce(batch[i], nnBruteForce(getPointers(points), queries[i],
+                                                                      metrics[m])));
+                }
+            }
+        }
+    }
+}
+
+// Packets of nearby queries, with the AVX2 kernel where the CPU has it
+// and with the scalar one, in both precisions
+KD_TEST(testFlatTreePacket) {
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 38);
+    vector<Point<double>> queries;
+    for (size_t i = 0; i < 203; ++i) {
+        vector<double> vect = points[i/8].getPointVector();
+        vect[i % 3] += 0.001*double(i % 8);
+        queries.push_back(Point<double>(vect));
+    }
+    vector<Point<float>> float_points, float_queries;
+    for (auto iter = points.begin(); iter != points.end(); ++iter) {
+        vector<double> vect = iter->getPointVector();
+        float_points.push_back(Point<float>(vector<float>(vect.begin(), vect.end()),
+                                            int(iter->getIndex())));
+    }
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        vector<double> vect = iter->getPointVector();
+        float_queries.push_back(Point<float>(vector<float>(vect.begin(), vect.end())));
+    }
+
+#ifdef KD_FLAT_TREE_AVX2
+    KD_CHECK(FlatKdTree<double>::usesPacketSimd() == bool(__builtin_cpu_supports("avx2")));
+#endif
+    FlatKdTree<double> flat = FlatKdTree<double>::flatten(
+        KdTree<double>::buildKdTree(getPointers(points)));
+    FlatKdTree<float> float_flat = FlatKdTree<float>::flatten(
+        KdTree<float>::buildKdTree(getPointers(float_points)));
+    vector<pair<size_t, double>> results[2];
+    vector<pair<size_t, float>> float_results[2];
+    for (int simd = 0; simd < 2; ++simd) {
+        ScopedSetting<bool> packet_simd(FlatKdTree<double>::packet_simd_, simd == 1);
+        ScopedSetting<bool> float_packet_simd(FlatKdTree<float>::packet_simd_, simd == 1);
+        KD_CHECK(simd == 1 || !FlatKdTree<double>::usesPacketSimd());
+        results[simd] = flat.findNearestPacket(getPointers(queries));
+        float_results[simd] = float_flat.findNearestPacket(getPointers(float_queries));
+        for (size_t i = 0; i < queries.size(); ++i) {
+            KD_CHECK(matchesBruteForce(results[simd][i], nnBruteForce(getPointers(points), queries[i])));
+            KD_CHECK(float_results[simd][i].first
+                     == nnBruteForce(getPointers(float_points), float_queries[i]).first);
+        }
+    }
+    KD_CHECK(results[0] == results[1]);
+    KD_CHECK(float_results[0] == float_results[1]);
+}
+
+// Warm-started streams of nearby queries, each hinted with the previous
+// result
+KD_TEST(testFlatTreeWarmStart) {
+    vector<Point<double>> points = getRandomPoints<double>(1500, 3, 39);
+    vector<Point<double>> queries;
+    for (size_t i = 0; i < 200; ++i)
+        queries.push_back(Point<double>({0.005*double(i) - 0.5, 0.3, -0.2}));
+    for (int bounds = 0; bounds < 2; ++bounds) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+        FlatKdTree<double> flat = FlatKdTree<double>::flatten(
+            KdTree<double>::buildKdTree(getPointers(points)), FlatKdTree<double>::Layout_t::BFS);
+        uint32_t hint = FlatKdTree<double>::null_node_;
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            KD_CHECK(matchesBruteForce(flat.findNearest(*iter, hint),
+                                       nnBruteForce(getPointers(points), *iter)));
+            KD_CHECK(hint != FlatKdTree<double>::null_node_);
+        }
+    }
+}
+
+// Unwritable and truncated files are reported instead of read as trees
+KD_TEST(testFlatTreeFileErrors) {
+    vector<Point<double>> points = getRandomPoints<double>(200, 2, 35);
+    FlatKdTree<double> flat = FlatKdTree<double>::flatten(
+        KdTree<double>::buildKdTree(getPointers(points)));
+
+    bool thrown = false;
+    try {
+        FlatKdTree<double>::WriteFlatKdTreeToFile(flat, "no_such_directory/tree.kdx");
+    }
+    catch (const runtime_error&) {
+        thrown = true;
+    }
+    KD_CHECK(thrown);
+
+    FlatKdTree<double>::WriteFlatKdTreeToFile(flat, flat_test_file);
+    ifstream in_stream(flat_test_file, ios::binary);
+    vector<char> bytes((istreambuf_iterator<char>(in_stream)), istreambuf_iterator<char>());
+    in_stream.close();
+    ofstream out_stream(flat_test_file, ios::binary);
+    out_stream.write(bytes.data(), bytes.size()/2);
+    out_stream.close();
+
+    thrown = false;
+    try {
+        FlatKdTree<double> read;
+        FlatKdTree<double>::ReadFlatKdTreeFromFile(read, flat_test_file);
+    }
+    catch (const runtime_error&) {
+        thrown = true;
+    }
+    KD_CHECK(thrown);
+    remove(flat_test_file);
+}
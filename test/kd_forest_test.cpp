@@ -0,0 +1,72 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cmath>
+#include <vector>
+#include "kd_test.h"
+#include "kd_forest.h"
+
+using namespace std;
+
+// Unlimited searches are exact for any tree count, with and without random
+// rotations, under every metric and in higher dimensions
+KD_TEST(testForestExact) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    size_t dimensions[] = {3, 16};
+    size_t tree_counts[] = {1, 4};
+    for (size_t d = 0; d < 2; ++d) {
+        vector<Point<double>> points = getRandomPoints<double>(1500, dimensions[d], 191 + d);
+        vector<Point<double>> queries = getRandomPoints<double>(50, dimensions[d], 193 + d);
+        for (size_t t = 0; t < 2; ++t) {
+            for (int rotate = 0; rotate < 2; ++rotate) {
+                for (size_t m = 0; m < 3; ++m) {
+                    KdForest<double> forest = KdForest<double>::buildKdForest(getPointers(points),
+                                                                              tree_counts[t],
+                                                                              rotate == 1, metrics[m]);
+                    KD_CHECK(forest.getTreeCount() == tree_counts[t]);
+                    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                        KD_CHECK(matchesBruteForce(forest.findNearest(*iter),
+                                                   nnBruteForce(getPointers(points), *iter, metrics[m])));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Budgeted searches report a real Point with its true distance, never
+// nearer than the exact answer
+KD_TEST(testForestBudget) {
+    vector<Point<double>> points = getRandomPoints<double>(2000, 16, 195);
+    vector<Point<double>> queries = getRandomPoints<double>(50, 16, 196);
+    KdForest<double> forest = KdForest<double>::buildKdForest(getPointers(points), 4, true);
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        pair<size_t, double> truth = nnBruteForce(getPointers(points), *iter);
+        pair<size_t, double> result = forest.findNearest(*iter, 64);
+        KD_CHECK(result.first < points.size());
+        KD_CHECK(abs(getDistance(points[result.first], *iter) - result.second)
+                 <= 1e-9*(1.0 + result.second));
+        KD_CHECK(result.second >= truth.second - 1e-9);
+    }
+}
@@ -0,0 +1,71 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "kd_test.h"
+
+using namespace std;
+
+// Axes get at most a mantissa of bits, so one-dimensional codes span
+// exactly the cells T can tell apart and stay ordered
+KD_TEST(testMortonCodeOneAxis) {
+    uint64_t double_cells = (uint64_t(1) << numeric_limits<double>::digits) - 1;
+    Point<double> low({-2.0}), range({4.0});
+    KD_CHECK(getMortonCode(Point<double>({-2.0}), low, range) == 0);
+    KD_CHECK(getMortonCode(Point<double>({2.0}), low, range) == double_cells);
+    KD_CHECK(getMortonCode(Point<double>({7.0}), low, range) == double_cells);
+    KD_CHECK(getMortonCode(Point<double>({-5.0}), low, range) == 0);
+
+    uint64_t float_cells = (uint64_t(1) << numeric_limits<float>::digits) - 1;
+    KD_CHECK(getMortonCode(Point<float>({1.0f}), Point<float>({0.0f}), Point<float>({1.0f}))
+             == float_cells);
+
+    vector<Point<double>> points = getRandomPoints<double>(500, 1, 51);
+    vector<Point<double>*> pointers = getPointers(points);
+    vector<size_t> order = getMortonOrder(pointers);
+    for (size_t i = 1; i < order.size(); ++i)
+        KD_CHECK(points[order[i-1]][0] <= points[order[i]][0]);
+}
+
+// Bits of the axes are interleaved, axis 0 lowest, and the order is a
+// permutation of the input, the same for Points and a coordinate buffer
+KD_TEST(testMortonCodeInterleaving) {
+    Point<double> low({0.0, 0.0}), range({1.0, 1.0});
+    uint64_t x_only = getMortonCode(Point<double>({1.0, 0.0}), low, range);
+    uint64_t y_only = getMortonCode(Point<double>({0.0, 1.0}), low, range);
+    KD_CHECK(x_only == 0x5555555555555555ULL);
+    KD_CHECK(y_only == 0xAAAAAAAAAAAAAAAAULL);
+    KD_CHECK(getMortonCode(Point<double>({1.0, 1.0}), low, range) == ~uint64_t(0));
+
+    vector<Point<double>> points = getRandomPoints<double>(300, 3, 52);
+    vector<size_t> order = getMortonOrder(getPointers(points));
+    vector<double> coords;
+    for (auto iter = points.begin(); iter != points.end(); ++iter)
+        coords.insert(coords.end(), iter->begin(), iter->end());
+    KD_CHECK(getMortonOrder(coords.data(), points.size(), 3) == order);
+    sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i)
+        KD_CHECK(order[i] == i);
+}
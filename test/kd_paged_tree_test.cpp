@@ -0,0 +1,114 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cstdio>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "kd_test.h"
+#include "kd_paged_tree.h"
+
+using namespace std;
+
+namespace {
+
+const char* const paged_test_file = "test_paged_tree.kdx";
+
+}
+
+// Paged views of every layout answer like brute force through a cache much
+// smaller than the file, under every metric and with PCA rotation
+KD_TEST(testPagedTree) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    typedef FlatKdTree<double>::Layout_t Layout_t;
+    ScopedSetting<size_t> resident_levels(PagedKdTree<double>::resident_levels_, 2);
+    ScopedSetting<size_t> page_bytes(PagedKdTree<double>::page_bytes_, 512);
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 211);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 212);
+    Layout_t layouts[] = {Layout_t::PREORDER, Layout_t::BFS, Layout_t::VEB};
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int pca = 0; pca < 2; ++pca) {
+        ScopedSetting<bool> pca_rotation(KdTree<double>::pca_rotation_, pca == 1);
+        for (int bounds = 0; bounds < 2; ++bounds) {
+            ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+            for (size_t m = 0; m < 3; ++m) {
+                KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+                for (size_t layout = 0; layout < 3; ++layout) {
+                    FlatKdTree<double> flat = FlatKdTree<double>::flatten(tree, layouts[layout]);
+                    FlatKdTree<double>::WriteFlatKdTreeToFile(flat, paged_test_file);
+                    PagedKdTree<double> paged = PagedKdTree<double>::open(paged_test_file, 4);
+                    KD_CHECK(paged.getNodeCount() == flat.getNodeCount());
+                    KD_CHECK(paged.getMetric() == metrics[m]);
+                    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                        KD_CHECK(matchesBruteForce(paged.findNearest(*iter),
+                                                   nnBruteForce(getPointers(points), *iter, metrics[m])));
+                    }
+                    KD_CHECK(paged.getCacheMisses() > 0 && paged.getCachedPageCount() <= 4);
+                }
+            }
+        }
+    }
+    remove(paged_test_file);
+}
+
+// Copies share one cache safely across threads
+KD_TEST(testPagedTreeThreads) {
+    ScopedSetting<size_t> page_bytes(PagedKdTree<double>::page_bytes_, 512);
+    vector<Point<double>> points = getRandomPoints<double>(3000, 3, 213);
+    vector<Point<double>> queries = getRandomPoints<double>(200, 3, 214);
+    FlatKdTree<double>::WriteFlatKdTreeToFile(
+        FlatKdTree<double>::flatten(KdTree<double>::buildKdTree(getPointers(points))), paged_test_file);
+    PagedKdTree<double> paged = PagedKdTree<double>::open(paged_test_file, 8);
+
+    vector<pair<size_t, double>> truth;
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        truth.push_back(nnBruteForce(getPointers(points), *iter));
+    }
+    vector<size_t> mismatches(3, 0);
+    vector<thread> readers;
+    for (size_t reader = 0; reader < 3; ++reader) {
+        readers.push_back(thread([&, reader]() {
+            PagedKdTree<double> view = paged;
+            for (size_t i = 0; i < queries.size(); ++i) {
+                if (!matchesBruteForce(view.findNearest(queries[(i + 67*reader) % queries.size()]),
+                                       truth[(i + 67*reader) % queries.size()]))
+                    ++mismatches[reader];
+            }
+        }));
+    }
+    for (auto iter = readers.begin(); iter != readers.end(); ++iter) {
+        iter->join();
+    }
+    KD_CHECK(mismatches == vector<size_t>(3, 0));
+    KD_CHECK(paged.getCachedPageCount() <= 8);
+    remove(paged_test_file);
+
+    bool thrown = false;
+    try {
+        PagedKdTree<double>::open(paged_test_file);
+    }
+    catch (const runtime_error&) {
+        thrown = true;
+    }
+    KD_CHECK(thrown);
+}
@@ -0,0 +1,145 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "kd_test.h"
+#include "kd_arena.h"
+#include "kd_point_set.h"
+#include "kd_flat_tree.h"
+#include "kd_forest.h"
+
+using namespace std;
+
+namespace {
+
+const char* const results_file = "query_results.csv";
+
+string readFile(const string& file) {
+    ifstream in_stream(file);
+    stringstream contents;
+    contents << in_stream.rdbuf();
+    return contents.str();
+}
+
+}
+
+// Points keep their coordinates and ids through a PointSet and back
+KD_TEST(testPointSetStorage) {
+    vector<Point<double>> points = getRandomPoints<double>(100, 3, 21);
+    PointSet<double> set(getPointers(points));
+    KD_CHECK(set.size() == points.size());
+    KD_CHECK(set.getDimension() == 3);
+    for (size_t i = 0; i < points.size(); ++i) {
+        PointView<double> view = set[i];
+        KD_CHECK(view.getIndex() == points[i].getIndex());
+        KD_CHECK(vector<double>(view.begin(), view.end()) == points[i].getPointVector());
+        KD_CHECK(set.data()[3*i + 2] == points[i][2]);
+    }
+
+    Arena arena;
+    vector<Point<double>*> copies = set.getPointers(arena);
+    KD_CHECK(copies.size() == points.size());
+    for (size_t i = 0; i < copies.size(); ++i)
+        KD_CHECK(*copies[i] == points[i] && copies[i]->getIndex() == points[i].getIndex());
+
+    bool thrown = false;
+    try {
+        set.push_back(Point<double>({1.0, 2.0}));
+    }
+    catch (const invalid_argument&) {
+        thrown = true;
+    }
+    KD_CHECK(thrown && set.size() == points.size());
+}
+
+// Trees built from a PointSet answer like brute force under every metric
+KD_TEST(testPointSetBuild) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(800, 4, 22);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 23);
+    PointSet<double> set(getPointers(points));
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t m = 0; m < 3; ++m) {
+        KdTree<double> tree = KdTree<double>::buildKdTree(set, metrics[m]);
+        KD_CHECK(tree.size() == points.size());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter)
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                       nnBruteForce(getPointers(points), *iter, metrics[m])));
+    }
+}
+
+// Forests built from a PointSet answer like brute force under every
+// metric, with and without rotations
+KD_TEST(testPointSetForest) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(800, 4, 228);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 229);
+    PointSet<double> set(getPointers(points));
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int rotate = 0; rotate < 2; ++rotate) {
+        for (size_t m = 0; m < 3; ++m) {
+            KdForest<double> forest = KdForest<double>::buildKdForest(set, 3, rotate == 1, metrics[m]);
+            KD_CHECK(forest.getDimension() == ((m == 2) ? 5u : 4u));
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter)
+                KD_CHECK(matchesBruteForce(forest.findNearest(*iter),
+                                           nnBruteForce(getPointers(points), *iter, metrics[m])));
+        }
+    }
+}
+
+// Queries read from a PointSet write the same results as from Points, in
+// Morton order and over several chunks of batched or packet flat queries
+KD_TEST(testPointSetQueries) {
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 230);
+    vector<Point<double>> queries = getRandomPoints<double>(5000, 3, 231);
+    PointSet<double> query_set(getPointers(queries));
+    string saved_results = readFile(results_file);
+
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    FlatKdTree<double> flat = FlatKdTree<double>::flatten(tree);
+    KdForest<double> forest = KdForest<double>::buildKdForest(getPointers(points));
+    for (int morton = 0; morton < 2; ++morton) {
+        ScopedSetting<bool> morton_query_order(KdTree<double>::morton_query_order_, morton == 1);
+        KdTree<double>::queryKdTree(tree, getPointers(queries));
+        string expected = readFile(results_file);
+        KdTree<double>::queryKdTree(tree, query_set);
+        KD_CHECK(readFile(results_file) == expected);
+        for (int packet = 0; packet < 2; ++packet) {
+            ScopedSetting<bool> packet_queries(FlatKdTree<double>::packet_queries_, packet == 1);
+            FlatKdTree<double>::queryFlatKdTree(flat, getPointers(queries));
+            string flat_expected = readFile(results_file);
+            FlatKdTree<double>::queryFlatKdTree(flat, query_set);
+            KD_CHECK(readFile(results_file) == flat_expected);
+        }
+    }
+    KdForest<double>::queryKdForest(forest, getPointers(queries));
+    string expected = readFile(results_file);
+    KdForest<double>::queryKdForest(forest, query_set);
+    KD_CHECK(readFile(results_file) == expected);
+
+    ofstream(results_file) << saved_results;
+}
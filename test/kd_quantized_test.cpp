@@ -0,0 +1,75 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <cstdio>
+#include <stdint.h>
+#include <vector>
+#include "kd_test.h"
+#include "kd_quantized.h"
+
+using namespace std;
+
+namespace {
+
+const char* const quantized_test_file = "test_quantized_exact.bin";
+
+// Quantized trees rerank to the exact brute-force answer
+template <typename Q>
+void checkQuantizedTree(const FlatKdTree<double>& flat, vector<Point<double>>& points,
+                        const vector<Point<double>>& queries,
+                        const typename KdTree<double>::Metric_t& metric) {
+    typedef typename QuantizedKdTree<double, Q>::Storage_t Storage_t;
+    Storage_t storages[] = {Storage_t::MEMORY, Storage_t::DISK};
+    for (size_t s = 0; s < 2; ++s) {
+        QuantizedKdTree<double, Q> quantized = QuantizedKdTree<double, Q>::quantize(flat, storages[s],
+                                                                                    quantized_test_file);
+        KD_CHECK(quantized.getDimension() == flat.getDimension());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            size_t reranked = 0;
+            KD_CHECK(matchesBruteForce(quantized.findNearest(*iter, &reranked),
+                                       nnBruteForce(getPointers(points), *iter, metric)));
+            KD_CHECK(reranked >= 1 && reranked <= points.size());
+        }
+    }
+    remove(quantized_test_file);
+}
+
+}
+
+// 8 and 16-bit codes, with exact coordinates in memory or on disk, under
+// every metric and with and without tight bounds
+KD_TEST(testQuantizedTree) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(2000, 4, 181);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 182);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int bounds = 0; bounds < 2; ++bounds) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, bounds == 1);
+        for (size_t m = 0; m < 3; ++m) {
+            FlatKdTree<double> flat = FlatKdTree<double>::flatten(
+                KdTree<double>::buildKdTree(getPointers(points), metrics[m]));
+            checkQuantizedTree<uint8_t>(flat, points, queries, metrics[m]);
+            checkQuantizedTree<uint16_t>(flat, points, queries, metrics[m]);
+        }
+    }
+}
@@ -0,0 +1,125 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+#ifndef KD_TEST_H_
+#define KD_TEST_H_
+
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+#include "kd_math.h"
+#include "kd_tree.h"
+#include "nn_test.cpp"
+
+// Minimal test registry. Each KD_TEST registers a function that the test
+// runner calls in turn; KD_CHECK reports a failed condition and counts it.
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<TestCase>& getTestCases() {
+    static std::vector<TestCase> test_cases;
+    return test_cases;
+}
+
+inline size_t& getFailureCount() {
+    static size_t failure_count = 0;
+    return failure_count;
+}
+
+struct TestRegistrar {
+    TestRegistrar(const char* name, void (*run)()) {
+        getTestCases().push_back(TestCase{name, run});
+    }
+};
+
+#define KD_TEST(name) \
+    static void name(); \
+    static TestRegistrar name##_registrar(#name, name); \
+    static void name()
+
+#define KD_CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            ++getFailureCount(); \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " \
+                      << #condition << std::endl; \
+        } \
+    } while (0)
+
+// Set a policy static for the lifetime of the guard
+template <typename V>
+class ScopedSetting {
+private:
+    V& setting_;
+    V saved_;
+public:
+    ScopedSetting(V& setting, const V& value) : setting_(setting), saved_(setting) {
+        setting_ = value;
+    }
+    ~ScopedSetting() {
+        setting_ = saved_;
+    }
+};
+
+// Points with coordinates drawn uniformly from [-1, 1), indexed 0..count-1
+template <typename T>
+std::vector<Point<T>> getRandomPoints(const size_t& count, const size_t& dimension,
+                                      const unsigned int& seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> coordinate(T(-1), T(1));
+    std::vector<Point<T>> points;
+    points.reserve(count);
+    std::vector<T> vect(dimension);
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t axis = 0; axis < dimension; ++axis)
+            vect[axis] = coordinate(rng);
+        points.push_back(Point<T>(vect, int(i)));
+    }
+    return points;
+}
+
+template <typename T>
+std::vector<Point<T>*> getPointers(std::vector<Point<T>>& points) {
+    std::vector<Point<T>*> pointers;
+    pointers.reserve(points.size());
+    for (auto iter = points.begin(); iter != points.end(); ++iter)
+        pointers.push_back(&(*iter));
+    return pointers;
+}
+
+// A {point index, score} result agrees with brute force. Indexes are
+// compared only when requested, since equally near Points may tie.
+template <typename T>
+bool matchesBruteForce(const std::pair<size_t, T>& result, const std::pair<size_t, T>& truth,
+                       const bool& compare_index = true) {
+    T tolerance = T(1e-9)*(T(1) + std::abs(truth.second));
+    return std::abs(result.second - truth.second) <= tolerance
+           && (!compare_index || result.first == truth.first);
+}
+
+#endif /* KD_TEST_H_ */
@@ -0,0 +1,468 @@
+// MIT License
+//
+// Copyright (c) 2017 Aum Jadhav (aum.jadhav@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+#include "kd_test.h"
+
+using namespace std;
+
+namespace {
+
+// Random walk of queries, each close to the previous one
+vector<Point<double>> getQueryWalk(const size_t& count, const size_t& dimension,
+                                   const unsigned int& seed) {
+    mt19937 rng(seed);
+    normal_distribution<double> step(0.0, 0.02);
+    vector<double> vect(dimension, 0.0);
+    vector<Point<double>> queries;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t axis = 0; axis < dimension; ++axis)
+            vect[axis] += step(rng);
+        queries.push_back(Point<double>(vect));
+    }
+    return queries;
+}
+
+// Every stored box holds all live Points of its subtree; returns false
+// when a node has no box
+bool boundsHoldSubtrees(const shared_ptr<KdTreeNode<double>>& node) {
+    if (node == nullptr)
+        return true;
+    vector<Point<double>> subtree;
+    KdTree<double>::collectPoints(node, subtree);
+    size_t dimension = node->point.getDimension();
+    if (node->bounds.size() != 2*dimension)
+        return false;
+    for (auto iter = subtree.begin(); iter != subtree.end(); ++iter) {
+        for (size_t axis = 0; axis < dimension; ++axis) {
+            if ((*iter)[axis] < node->bounds[axis] || (*iter)[axis] > node->bounds[dimension+axis])
+                return false;
+        }
+    }
+    return boundsHoldSubtrees(node->left_child) && boundsHoldSubtrees(node->right_child);
+}
+
+}
+
+// Every metric reports the brute-force neighbour and score; cosine results
+// do not depend on the query's length
+KD_TEST(testMetrics) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    size_t dimensions[] = {2, 5, 8};
+    for (size_t d = 0; d < 3; ++d) {
+        vector<Point<double>> points = getRandomPoints<double>(2000, dimensions[d], 121 + d);
+        vector<Point<double>> queries = getRandomPoints<double>(100, dimensions[d], 124 + d);
+        for (size_t m = 0; m < 3; ++m) {
+            KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+            KD_CHECK(tree.getMetric() == metrics[m]);
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                           nnBruteForce(getPointers(points), *iter, metrics[m])));
+            }
+        }
+    }
+
+    vector<Point<double>> points = getRandomPoints<double>(1000, 4, 127);
+    vector<Point<double>> queries = getRandomPoints<double>(50, 4, 128);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), Metric_t::COSINE);
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        vector<double> scaled = iter->getPointVector();
+        for (auto coord = scaled.begin(); coord != scaled.end(); ++coord)
+            *coord *= 5.0;
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, Point<double>(scaled)),
+                                   KdTree<double>::findNearest(tree, *iter)));
+    }
+}
+
+// Inserted Points, into an empty or a built tree, are found like brute
+// force under every metric and balance factor
+KD_TEST(testInsert) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 131);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 132);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    double balance_factors[] = {0.6, 0.9};
+    for (size_t b = 0; b < 2; ++b) {
+        ScopedSetting<double> balance_factor(KdTree<double>::balance_factor_, balance_factors[b]);
+        for (size_t m = 0; m < 3; ++m) {
+            vector<Point<double>> built(points.begin(), points.begin() + 500);
+            KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(built), metrics[m]);
+            for (size_t i = 500; i < points.size(); ++i) {
+                tree.insert(points[i]);
+            }
+            KD_CHECK(tree.size() == points.size());
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                           nnBruteForce(getPointers(points), *iter, metrics[m])));
+            }
+        }
+
+        KdTree<double> empty;
+        for (auto iter = points.begin(); iter != points.end(); ++iter) {
+            empty.insert(*iter);
+        }
+        KD_CHECK(empty.size() == points.size());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(empty, *iter),
+                                       nnBruteForce(getPointers(points), *iter)));
+        }
+    }
+}
+
+// With copy-on-write, copies taken before an insert keep their old contents
+KD_TEST(testInsertCopyOnWrite) {
+    vector<Point<double>> points = getRandomPoints<double>(1000, 3, 133);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 134);
+    vector<Point<double>> built(points.begin(), points.begin() + 600);
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(built));
+    tree.setCopyOnWrite(true);
+    KdTree<double> snapshot = tree;
+    for (size_t i = 600; i < points.size(); ++i) {
+        tree.insert(points[i]);
+    }
+    KD_CHECK(snapshot.size() == built.size());
+    KD_CHECK(tree.size() == points.size());
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(snapshot, *iter),
+                                   nnBruteForce(getPointers(built), *iter)));
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                   nnBruteForce(getPointers(points), *iter)));
+    }
+}
+
+// Erased Points are never reported, whether they are still tombstones or
+// compacted away
+KD_TEST(testEraseCompact) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 141);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 142);
+    vector<Point<double>> remaining;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i % 3 != 0)
+            remaining.push_back(points[i]);
+    }
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    double thresholds[] = {0.2, 1.0};
+    for (size_t t = 0; t < 2; ++t) {
+        ScopedSetting<double> compaction(KdTree<double>::compaction_threshold_, thresholds[t]);
+        for (size_t m = 0; m < 3; ++m) {
+            KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+            for (size_t i = 0; i < points.size(); i += 3) {
+                KD_CHECK((i % 2 == 0) ? tree.erase(i) : tree.erase(points[i]));
+            }
+            KD_CHECK(!tree.erase(0) && !tree.erase(size_t(points.size())));
+            KD_CHECK(tree.size() == remaining.size());
+            for (int compacted = 0; compacted < 2; ++compacted) {
+                if (compacted == 1)
+                    tree.compact();
+                KD_CHECK(tree.getPoints().size() == remaining.size());
+                for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                    KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                               nnBruteForce(getPointers(remaining), *iter, metrics[m])));
+                }
+            }
+        }
+    }
+}
+
+// With copy-on-write, copies taken before erasing and compacting keep
+// the erased Points
+KD_TEST(testEraseCopyOnWrite) {
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 143);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 144);
+    vector<Point<double>> remaining;
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i % 3 != 0)
+            remaining.push_back(points[i]);
+    }
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    tree.setCopyOnWrite(true);
+    KdTree<double> snapshot = tree;
+    for (size_t i = 0; i < points.size(); i += 3) {
+        tree.erase(points[i]);
+    }
+    tree.compact();
+    KD_CHECK(snapshot.size() == points.size());
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(snapshot, *iter),
+                                   nnBruteForce(getPointers(points), *iter)));
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                   nnBruteForce(getPointers(remaining), *iter)));
+    }
+}
+
+// Tight boxes hold their subtrees after builds, inserts and erases, and
+// searches pruned by them answer like brute force
+KD_TEST(testTightBounds) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, true);
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 161);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 162);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t m = 0; m < 3; ++m) {
+        vector<Point<double>> built(points.begin(), points.begin() + 1500);
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(built), metrics[m]);
+        KdTreeNode<double> root = tree.getRootNode();
+        KD_CHECK(boundsHoldSubtrees(make_shared<KdTreeNode<double>>(root)));
+
+        vector<Point<double>> remaining;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (i >= built.size())
+                tree.insert(points[i]);
+            if (i % 4 == 0)
+                tree.erase(points[i]);
+            else
+                remaining.push_back(points[i]);
+        }
+        root = tree.getRootNode();
+        KD_CHECK(boundsHoldSubtrees(make_shared<KdTreeNode<double>>(root)));
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                       nnBruteForce(getPointers(remaining), *iter, metrics[m])));
+        }
+    }
+}
+
+// Morton presorted builds keep every Point and answer like brute force
+KD_TEST(testMortonPresort) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    ScopedSetting<bool> morton_presort(KdTree<double>::morton_presort_, true);
+    vector<Point<double>> points = getRandomPoints<double>(2000, 4, 171);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 172);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (int tight = 0; tight < 2; ++tight) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, tight == 1);
+        for (size_t m = 0; m < 3; ++m) {
+            KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+            vector<Point<double>> stored = tree.getPoints();
+            vector<bool> seen(points.size(), false);
+            for (auto iter = stored.begin(); iter != stored.end(); ++iter) {
+                seen[iter->getIndex()] = true;
+            }
+            KD_CHECK(stored.size() == points.size()
+                     && find(seen.begin(), seen.end(), false) == seen.end());
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                           nnBruteForce(getPointers(points), *iter, metrics[m])));
+            }
+        }
+    }
+}
+
+// Warm-started streams, fed back the hint of each result, answer like
+// brute force, including in a rotated and transformed search space
+KD_TEST(testWarmStartQueries) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(1500, 3, 61);
+    vector<Point<double>> queries = getQueryWalk(200, 3, 62);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE};
+    for (int pca = 0; pca < 2; ++pca) {
+        ScopedSetting<bool> pca_rotation(KdTree<double>::pca_rotation_, pca == 1);
+        for (size_t m = 0; m < 2; ++m) {
+            KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+            Point<double> hint;
+            for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                pair<size_t, double> result = KdTree<double>::findNearest(tree, *iter, hint);
+                KD_CHECK(matchesBruteForce(result, nnBruteForce(getPointers(points), *iter, metrics[m])));
+                KD_CHECK(hint.getIndex() == result.first);
+            }
+        }
+    }
+
+    // Nothing within the bound leaves the hint as it was
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    Point<double> hint;
+    KdTree<double>::findNearest(tree, queries[0], hint);
+    Point<double> previous = hint;
+    pair<size_t, double> none = KdTree<double>::findNearest(tree, Point<double>({9.0, 9.0, 9.0}),
+                                                            hint, 1.0);
+    KD_CHECK(none.first == numeric_limits<size_t>::max());
+    KD_CHECK(hint == previous && hint.getIndex() == previous.getIndex());
+}
+
+// A PCA-rotated tree answers like brute force, and an insert that raises
+// the largest inner-product norm rebuilds it in the same rotation even
+// after the build policies have changed
+KD_TEST(testPcaRotationInsert) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    vector<Point<double>> points = getRandomPoints<double>(1200, 4, 71);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 72);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t m = 0; m < 3; ++m) {
+        KdTree<double> tree;
+        {
+            ScopedSetting<bool> pca_rotation(KdTree<double>::pca_rotation_, true);
+            tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+        }
+        vector<double> rotation = tree.getRotation();
+        KD_CHECK(rotation.size() == 16);
+
+        ScopedSetting<bool> morton_presort(KdTree<double>::morton_presort_, true);
+        vector<Point<double>> all_points = points;
+        all_points.push_back(Point<double>({2.0, -2.0, 2.0, 2.0}, 1200));
+        tree.insert(all_points.back());
+        KD_CHECK(tree.getRotation() == rotation);
+        KD_CHECK(tree.size() == all_points.size());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                       nnBruteForce(getPointers(all_points), *iter, metrics[m])));
+        }
+    }
+}
+
+// Every split method answers like brute force whether subsets are split
+// from sampled, full or range-only statistics, with and without tight bounds
+KD_TEST(testSplitMethods) {
+    typedef KdTree<double>::SplitMethod_t SplitMethod_t;
+    vector<Point<double>> points = getRandomPoints<double>(2000, 4, 81);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 4, 82);
+    SplitMethod_t methods[] = {SplitMethod_t::CYCLE, SplitMethod_t::VARIANCE, SplitMethod_t::RANGE};
+    size_t thresholds[] = {0, 256, 5000};
+    for (size_t m = 0; m < 3; ++m) {
+        ScopedSetting<SplitMethod_t> split_method(KdTree<double>::split_method_, methods[m]);
+        for (int tight = 0; tight < 2; ++tight) {
+            ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, tight == 1);
+            for (size_t t = 0; t < 3; ++t) {
+                ScopedSetting<size_t> range_stats(KdTree<double>::range_stats_threshold_, thresholds[t]);
+                KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+                for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                    KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                               nnBruteForce(getPointers(points), *iter,
+                                                            KdTree<double>::Metric_t::EUCLIDEAN)));
+                }
+            }
+        }
+    }
+
+    // A small subset whose widest axis is two outliers: VARIANCE splits
+    // the spread axis, RANGE the wide one
+    vector<Point<double>> skewed;
+    for (size_t i = 0; i < 100; ++i) {
+        double outlier = (i == 0) ? 10.0 : ((i == 1) ? -10.0 : 0.0);
+        skewed.push_back(Point<double>({outlier, -3.0 + 6.0*i/99.0}, int(i)));
+    }
+    {
+        ScopedSetting<SplitMethod_t> split_method(KdTree<double>::split_method_, SplitMethod_t::VARIANCE);
+        KD_CHECK(KdTree<double>::buildKdTree(getPointers(skewed)).getRootNode().split_axis == 1);
+    }
+    {
+        ScopedSetting<SplitMethod_t> split_method(KdTree<double>::split_method_, SplitMethod_t::RANGE);
+        KD_CHECK(KdTree<double>::buildKdTree(getPointers(skewed)).getRootNode().split_axis == 0);
+    }
+}
+
+// Sampled splits answer like brute force and the same seed builds the same tree
+KD_TEST(testSampledBuild) {
+    ScopedSetting<size_t> sample_size(KdTree<double>::split_sample_size_, 64);
+    ScopedSetting<size_t> sample_threshold(KdTree<double>::split_sample_threshold_, 300);
+    vector<Point<double>> points = getRandomPoints<double>(5000, 3, 91);
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 92);
+    for (int tight = 0; tight < 2; ++tight) {
+        ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, tight == 1);
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+        KD_CHECK(tree.size() == points.size());
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                       nnBruteForce(getPointers(points), *iter,
+                                                    KdTree<double>::Metric_t::EUCLIDEAN)));
+        }
+
+        vector<Point<double>> first = tree.getPoints();
+        vector<Point<double>> second = KdTree<double>::buildKdTree(getPointers(points)).getPoints();
+        bool same_order = first.size() == second.size();
+        for (size_t i = 0; same_order && i < first.size(); ++i) {
+            same_order = first[i].getIndex() == second[i].getIndex();
+        }
+        KD_CHECK(same_order);
+    }
+}
+
+// Presorted builds answer like brute force for every split method, also
+// with many repeated coordinates, and split at exact medians
+KD_TEST(testPresortedBuild) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    typedef KdTree<double>::SplitMethod_t SplitMethod_t;
+    ScopedSetting<bool> presorted_build(KdTree<double>::presorted_build_, true);
+    vector<Point<double>> points = getRandomPoints<double>(2000, 3, 201);
+    for (size_t i = 0; i < points.size(); i += 2) {
+        vector<double> vect = points[i].getPointVector();
+        vect[i % 3] = 0.25;
+        points[i] = Point<double>(vect, int(i));
+    }
+    vector<Point<double>> queries = getRandomPoints<double>(100, 3, 202);
+    SplitMethod_t methods[] = {SplitMethod_t::CYCLE, SplitMethod_t::VARIANCE, SplitMethod_t::RANGE};
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t s = 0; s < 3; ++s) {
+        ScopedSetting<SplitMethod_t> split_method(KdTree<double>::split_method_, methods[s]);
+        for (int tight = 0; tight < 2; ++tight) {
+            ScopedSetting<bool> tight_bounds(KdTree<double>::tight_bounds_, tight == 1);
+            for (size_t m = 0; m < 3; ++m) {
+                KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+                KD_CHECK(tree.size() == points.size());
+                KdTreeNode<double> root = tree.getRootNode();
+                KD_CHECK(root.left_child != nullptr && root.right_child != nullptr
+                         && root.left_child->size <= root.right_child->size + 1);
+                for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+                    KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                               nnBruteForce(getPointers(points), *iter, metrics[m])));
+                }
+            }
+        }
+    }
+}
+
+// Lazy builds answer like brute force from the first query on, including
+// warm-started ones, and updates build the rest of the tree first
+KD_TEST(testLazyBuild) {
+    typedef KdTree<double>::Metric_t Metric_t;
+    ScopedSetting<bool> lazy_build(KdTree<double>::lazy_build_, true);
+    ScopedSetting<size_t> lazy_subtree_size(KdTree<double>::lazy_subtree_size_, 32);
+    vector<Point<double>> points = getRandomPoints<double>(3000, 3, 111);
+    vector<Point<double>> queries = getQueryWalk(100, 3, 112);
+    Metric_t metrics[] = {Metric_t::EUCLIDEAN, Metric_t::COSINE, Metric_t::INNER_PRODUCT};
+    for (size_t m = 0; m < 3; ++m) {
+        KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points), metrics[m]);
+        KD_CHECK(tree.size() == points.size());
+        Point<double> hint;
+        for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+            pair<size_t, double> truth = nnBruteForce(getPointers(points), *iter, metrics[m]);
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter), truth));
+            KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter, hint), truth));
+        }
+    }
+
+    vector<Point<double>> remaining(points.begin() + 1, points.end());
+    remaining.push_back(Point<double>({0.5, 0.5, 0.5}, 3000));
+    KdTree<double> tree = KdTree<double>::buildKdTree(getPointers(points));
+    KD_CHECK(tree.erase(points[0]));
+    tree.insert(remaining.back());
+    KD_CHECK(tree.getPoints().size() == remaining.size());
+    for (auto iter = queries.begin(); iter != queries.end(); ++iter) {
+        KD_CHECK(matchesBruteForce(KdTree<double>::findNearest(tree, *iter),
+                                   nnBruteForce(getPointers(remaining), *iter, Metric_t::EUCLIDEAN)));
+    }
+}